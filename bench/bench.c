@@ -0,0 +1,298 @@
+#include "parse.h"
+#include "execute.h"
+#include "builtin.h"
+#include "logger.h"
+#include "signals.h"
+#include "shell.h"
+#include "vars.h"
+#include "pathcache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+extern char **environ;
+
+static int g_csv = 0;
+static int g_first = 1;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double pct(const double *sorted, int n, double p) {
+    int rank = (int)(p / 100.0 * n + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+    return sorted[rank - 1];
+}
+
+static void report(const char *name, const char *unit, double *samples, int n) {
+    if (n == 0) return;
+    qsort(samples, (size_t)n, sizeof(double), cmp_double);
+    double median = pct(samples, n, 50), p90 = pct(samples, n, 90), p99 = pct(samples, n, 99);
+
+    if (g_csv) {
+        if (g_first) printf("name,unit,n,median,p90,p99,min,max\n");
+        printf("%s,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n", name, unit, n, median, p90, p99, samples[0], samples[n - 1]);
+    } else {
+        printf("%s\n  {\"name\":\"%s\",\"unit\":\"%s\",\"n\":%d,\"median\":%.3f,\"p90\":%.3f,\"p99\":%.3f,"
+               "\"min\":%.3f,\"max\":%.3f}",
+               g_first ? "[" : ",", name, unit, n, median, p90, p99, samples[0], samples[n - 1]);
+    }
+    g_first = 0;
+    fflush(stdout);
+}
+
+static int quiet_stdout(void) {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+    return saved;
+}
+
+static void restore_stdout(int saved) {
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+static void bench_parse(const char *name, const char *line, int iters, int samples) {
+    double *s = (double *)malloc(sizeof(double) * (size_t)samples);
+    for (int k = 0; k < samples; k++) {
+        double t0 = now();
+        for (int i = 0; i < iters; i++) {
+            const char *err;
+            Command *cmd = parse_line(line, &err);
+            free_command(cmd);
+        }
+        s[k] = (now() - t0) * 1e9 / iters;
+    }
+    report(name, "ns/line", s, samples);
+    free(s);
+}
+
+static void count_match(const char *name, void *ctx) {
+    (void)name;
+    (*(size_t *)ctx)++;
+}
+
+static void bench_complete(const char *prefix, int iters, int samples) {
+    size_t matches = 0;
+    double t0 = now();
+    pathcache_complete(prefix, count_match, &matches);
+    double first = (now() - t0) * 1e3;
+
+    double *s = (double *)malloc(sizeof(double) * (size_t)samples);
+    for (int k = 0; k < samples; k++) {
+        t0 = now();
+        for (int i = 0; i < iters; i++) pathcache_complete(prefix, count_match, &matches);
+        s[k] = (now() - t0) * 1e9 / iters;
+    }
+    report("complete_index_build", "ms", &first, 1);
+    report("complete_prefix", "ns/query", s, samples);
+    free(s);
+}
+
+static void bench_exec(Shell *sh, const char *launch, const char *name, const char *line, int samples) {
+    execute_set_launch(launch);
+    const char *err;
+    Command *cmd = parse_line(line, &err);
+    double *s = (double *)malloc(sizeof(double) * (size_t)samples);
+    for (int k = 0; k < samples; k++) {
+        double t0 = now();
+        execute_command(sh, cmd);
+        s[k] = (now() - t0) * 1e6;
+    }
+    report(name, "us", s, samples);
+    free(s);
+    free_command(cmd);
+    execute_set_launch("spawn");
+}
+
+/* One request/response over `coproc`, to set against exec_spawn. */
+static void bench_coproc(Shell *sh, int iters, int samples) {
+    const char *err;
+    Command *start = parse_line("coproc BENCH /bin/cat", &err);
+    Command *ask = parse_line("cowrite BENCH ping", &err);
+    Command *answer = parse_line("coread BENCH REPLY", &err);
+    Command *stop = parse_line("coclose BENCH", &err);
+
+    int saved = quiet_stdout();
+    builtin_execute(sh, start);
+    restore_stdout(saved);
+
+    double *s = (double *)malloc(sizeof(double) * (size_t)samples);
+    for (int k = 0; k < samples; k++) {
+        double t0 = now();
+        for (int i = 0; i < iters; i++) {
+            builtin_execute(sh, ask);
+            builtin_execute(sh, answer);
+        }
+        s[k] = (now() - t0) * 1e6 / iters;
+    }
+    report("coproc_roundtrip", "us", s, samples);
+    free(s);
+
+    builtin_execute(sh, stop);
+    while (jobs_live(&sh->jobs) > 0) {
+        struct pollfd pfd = { .fd = sh->reap_fd, .events = POLLIN, .revents = 0 };
+        if (poll(&pfd, 1, 1000) < 0 && errno != EINTR) break;
+        jobs_handle_reaped(&sh->jobs, sh->reap_fd, sh->log_fd);
+    }
+    free_command(start);
+    free_command(ask);
+    free_command(answer);
+    free_command(stop);
+}
+
+static void bench_pipeline(Shell *sh, long mib, int samples) {
+    char line[256];
+    snprintf(line, sizeof(line), "/usr/bin/head -c %ld /dev/zero | /bin/cat > /dev/null", mib << 20);
+    const char *err;
+    Command *cmd = parse_line(line, &err);
+    double *s = (double *)malloc(sizeof(double) * (size_t)samples);
+    for (int k = 0; k < samples; k++) {
+        double t0 = now();
+        execute_command(sh, cmd);
+        s[k] = (double)mib / (now() - t0);
+    }
+    report("pipeline_2stage", "MB/s", s, samples);
+    free(s);
+    free_command(cmd);
+}
+
+static void bench_logger(const char *mode, const char *name, int records, int samples) {
+    char path[] = "/tmp/myshell-bench-log-XXXXXX";
+    int tmp = mkstemp(path);
+    if (tmp < 0) {
+        perror("mkstemp");
+        return;
+    }
+    close(tmp);
+
+    setenv("MYSHELL_LOG_MODE", mode, 1);
+    double *s = (double *)malloc(sizeof(double) * (size_t)samples);
+    for (int k = 0; k < samples; k++) {
+        if (truncate(path, 0) < 0) perror("truncate");
+        int fd = logger_open(path);
+        double t0 = now();
+        for (int i = 0; i < records; i++) logger_log(fd, 1000 + i, "gcc -O2 -c src/parse.c -o src/parse.o", 0);
+        logger_close(fd);
+        s[k] = records / (now() - t0);
+    }
+    unsetenv("MYSHELL_LOG_MODE");
+    report(name, "records/s", s, samples);
+    free(s);
+    unlink(path);
+}
+
+static void bench_burst(Shell *sh, int jobs, int samples) {
+    const char *err;
+    Command *cmd = parse_line("/bin/true &", &err);
+    double *total = (double *)malloc(sizeof(double) * (size_t)samples);
+    double *drain = (double *)malloc(sizeof(double) * (size_t)samples);
+
+    for (int k = 0; k < samples; k++) {
+        int saved = quiet_stdout();
+        double t0 = now();
+        for (int i = 0; i < jobs; i++) {
+            execute_command(sh, cmd);
+            jobs_handle_reaped(&sh->jobs, sh->reap_fd, sh->log_fd);
+        }
+        double t1 = now();
+        while (jobs_live(&sh->jobs) > 0) {
+            struct pollfd pfd = { .fd = sh->reap_fd, .events = POLLIN, .revents = 0 };
+            if (poll(&pfd, 1, 1000) < 0 && errno != EINTR) break;
+            jobs_handle_reaped(&sh->jobs, sh->reap_fd, sh->log_fd);
+        }
+        double t2 = now();
+        restore_stdout(saved);
+        total[k] = (t2 - t0) * 1e3;
+        drain[k] = (t2 - t1) * 1e3;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "sigchld_burst_%d_total", jobs);
+    report(name, "ms", total, samples);
+    snprintf(name, sizeof(name), "sigchld_burst_%d_drain", jobs);
+    report(name, "ms", drain, samples);
+    free(total);
+    free(drain);
+    free_command(cmd);
+}
+
+int main(int argc, char **argv) {
+    int quick = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) g_csv = 1;
+        else if (strcmp(argv[i], "--quick") == 0) quick = 1;
+        else {
+            fprintf(stderr, "usage: bench [--csv] [--quick]\n");
+            return 2;
+        }
+    }
+    int scale = quick ? 10 : 1;
+    vars_init(environ);
+
+    char ops_line[] = "cat < in.txt | grep -v foo | sort -r | uniq -c | head -5 > out.txt &";
+    char long_line[4096];
+    size_t len = 0;
+    memcpy(long_line, "gcc", 3);
+    len = 3;
+    for (int i = 0; len + 32 < sizeof(long_line); i++) {
+        len += (size_t)snprintf(long_line + len, sizeof(long_line) - len, " -Isrc/module%d/include", i);
+    }
+
+    parse_set_cache("0");
+    bench_parse("parse_short", "ls -l", 100000 / scale, 30);
+    bench_parse("parse_long", long_line, 2000 / scale, 30);
+    bench_parse("parse_operators", ops_line, 50000 / scale, 30);
+    parse_set_cache("1M");
+    bench_parse("parse_short_cached", "ls -l", 100000 / scale, 30);
+    bench_parse("parse_long_cached", long_line, 2000 / scale, 30);
+
+    bench_complete("ca", 100000 / scale, 30);
+
+    bench_logger("sync", "logger_sync", 200000 / scale, 10);
+    bench_logger("async", "logger_async", 200000 / scale, 10);
+
+    Shell sh;
+    memset(&sh, 0, sizeof(sh));
+    jobs_init(&sh.jobs);
+    sh.log_fd = -1;
+    sh.tty_fd = -1;
+    sh.pgid = getpgrp();
+    sh.reap_fd = signals_init();
+    if (sh.reap_fd < 0) {
+        perror("signals_init");
+        return 1;
+    }
+
+    bench_exec(&sh, "spawn", "exec_spawn", "/bin/true", 300 / scale);
+    bench_exec(&sh, "fork", "exec_fork", "/bin/true", 300 / scale);
+    bench_exec(&sh, "spawn", "exec_with_attrs", "with cpus=0 nice=1 nofile=1024 -- /bin/true", 300 / scale);
+    bench_exec(&sh, "spawn", "exec_wrapped", "/usr/bin/taskset -c 0 /usr/bin/nice -n 1 /bin/true", 300 / scale);
+    bench_coproc(&sh, 1000 / scale, 30);
+    bench_pipeline(&sh, quick ? 64 : 512, 5);
+    bench_burst(&sh, 10000 / scale, quick ? 1 : 3);
+
+    if (!g_csv && !g_first) printf("\n]\n");
+    jobs_cleanup(&sh.jobs);
+    close(sh.reap_fd);
+    return 0;
+}
@@ -0,0 +1,18 @@
+#!/bin/sh
+# Pipeline throughput for a range of pipe capacities.
+# usage: bench/pipesize.sh [MiB] [sizes...]
+# Prints CSV: pipesize,bytes,seconds,mb_per_s
+
+SHELL_BIN=${SHELL_BIN:-./myshell}
+MIB=${1:-1024}
+[ $# -gt 0 ] && shift
+SIZES=${*:-"0 256K 1M"}
+BYTES=$((MIB * 1048576))
+
+echo "pipesize,bytes,seconds,mb_per_s"
+for size in $SIZES; do
+    secs=$(MYSHELL_PIPESIZE=$size "$SHELL_BIN" -c "time /usr/bin/head -c $BYTES /dev/zero | /bin/cat > /dev/null" 2>&1 >/dev/null |
+           awk '$1 == "real" { sub(/s$/, "", $2); print $2 }')
+    [ -n "$secs" ] || { echo "pipesize.sh: no timing for $size" >&2; continue; }
+    awk -v s="$size" -v b="$BYTES" -v t="$secs" 'BEGIN { printf "%s,%.0f,%.3f,%.1f\n", s, b, t, b / 1048576 / t }'
+done
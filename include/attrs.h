@@ -0,0 +1,33 @@
+#ifndef ATTRS_H
+#define ATTRS_H
+
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+#define ATTRS_NLIMITS 8
+
+/* What a launched command gets on top of what it inherits from the shell:
+ * a CPU set, a nice level and resource limits. Only the parts marked as set
+ * are applied. */
+typedef struct Attrs {
+    int has_cpus;
+    cpu_set_t cpus;
+    int has_nice;
+    int nice;
+    unsigned limits_set;
+    rlim_t limits[ATTRS_NLIMITS];
+} Attrs;
+
+Attrs *attrs_session(void);
+int attrs_any(const Attrs *a);
+int attrs_set(Attrs *a, const char *who, const char *word);
+int attrs_set_cpus(Attrs *a, const char *who, const char *list);
+int attrs_set_nice(Attrs *a, const char *who, const char *value);
+void attrs_describe(const Attrs *a, char *buf, size_t n);
+void attrs_print_cpus(FILE *out, const Attrs *a);
+void attrs_print_limits(FILE *out, const Attrs *a);
+int attrs_apply(const Attrs *a);
+
+#endif
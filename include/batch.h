@@ -0,0 +1,9 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "input.h"
+#include "shell.h"
+
+int batch_run(Shell *sh, Input *in, int njobs, int ordered);
+
+#endif
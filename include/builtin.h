@@ -2,6 +2,7 @@
 #define BUILTIN_H
 
 #include "parse.h"
+#include "shell.h"
 
 enum {
     BUILTIN_NONE = 0,
@@ -9,7 +10,30 @@ enum {
     BUILTIN_EXIT = 2
 };
 
-int builtin_execute(Command *cmd);
+/* BUILTIN_STAGE builtins only touch their stdio and argv, so they can also
+ * run in a forked child as a pipeline stage or background job.
+ * BUILTIN_BLOCKS ones can wait on their input, a timer or a slow reader, so
+ * a pipeline never runs them inside the shell. */
+enum {
+    BUILTIN_STAGE = 1,
+    BUILTIN_QUITS = 2,
+    BUILTIN_BLOCKS = 4
+};
 
-#endif
+/* opts is NULL when the builtin parses its own arguments. Otherwise it
+ * stands in for a PATH command and implements only these option letters;
+ * any other option sends the command to the real one. */
+typedef struct Builtin {
+    const char *name;
+    int (*run)(Shell *sh, Command *cmd);
+    int flags;
+    const char *opts;
+} Builtin;
 
+const Builtin *builtin_find(const char *name);
+const Builtin *builtin_for(Command *cmd);
+const char *builtin_name(size_t i);
+int builtin_run(Shell *sh, const Builtin *b, Command *cmd, int in_fd, int out_fd);
+int builtin_execute(Shell *sh, Command *cmd);
+
+#endif
@@ -2,9 +2,28 @@
 #define EXECUTE_H
 
 #include "parse.h"
-#include "jobs.h"
+#include "shell.h"
+#include <sys/types.h>
 
-int execute_command(Command *cmd, int log_fd, Jobs *jobs);
+enum {
+    LAUNCH_FORK = 0,
+    LAUNCH_SPAWN = 1
+};
+
+int execute_set_launch(const char *name);
+const char *execute_launch_name(void);
+int execute_set_pipesize(const char *arg, int *capped);
+int execute_pipesize(void);
+int execute_command(Shell *sh, Command *cmd);
+int execute_line(Shell *sh, Command *cmd);
+int execute_stages(Command *cmd);
+int execute_exit_code(int status);
+int execute_foreground(Shell *sh, int id);
+int execute_start(Command *cmd, int out_fd, int err_fd, pid_t *pids, const char **attrs);
+Job *execute_coproc(Shell *sh, Command *cmd, Coproc *co);
+const char *execute_attrs(void);
+int execute_redir_open(const Redir *r);
+const char *execute_redir_name(const Redir *r);
 
 #endif
 
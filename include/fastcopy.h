@@ -0,0 +1,9 @@
+#ifndef FASTCOPY_H
+#define FASTCOPY_H
+
+#include <sys/types.h>
+
+off_t fastcopy_fd(int in_fd, int out_fd);
+off_t fastcopy_tee(int in_fd, int out_fd, int file_fd);
+
+#endif
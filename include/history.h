@@ -0,0 +1,14 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+int history_open(const char *path);
+void history_close(void);
+void history_add(const char *line, size_t len);
+size_t history_count(void);
+const char *history_get(size_t i, size_t *len);
+long history_search(const char *needle, size_t n, long before, int prefix);
+int history_expand(const char *line, size_t len, char **out);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+
+typedef struct Input {
+    int fd;
+    int owns_fd;
+    int interactive;
+
+    const char *data;
+    size_t len;
+    size_t pos;
+    size_t map_len;
+
+    char *buf;
+    size_t cap;
+    size_t start;
+    size_t end;
+    int eof;
+
+    int (*wait)(void *ctx, int fd);
+    void *wait_ctx;
+} Input;
+
+int input_open_fd(Input *in, int fd);
+int input_open_file(Input *in, const char *path);
+void input_open_string(Input *in, const char *s);
+const char *input_next(Input *in, size_t *out_len);
+void input_close(Input *in);
+
+#endif
@@ -2,21 +2,81 @@
 #define JOBS_H
 
 #include <sys/types.h>
+#include "signals.h"
+#include "usage.h"
+
+/* A job started by `coproc NAME cmd`: the shell's ends of the pipes to the
+ * command's stdin and from its stdout, and what has been read ahead. Once the
+ * job is reaped it moves to the detached list until its output is read. */
+typedef struct Coproc {
+    char *name;
+    int to_fd;
+    int from_fd;
+    char *buf;
+    size_t start;
+    size_t end;
+    size_t cap;
+    struct Coproc *next;
+} Coproc;
 
 typedef struct Job {
-    pid_t pid;
+    int id;
+    pid_t pgid;
     char *cmdline;
-    struct Job *next;
+    pid_t *pids;
+    int *statuses;
+    int npids;
+    int remaining;
+    int stopped;
+    Usage usage;
+    char *attrs;
+    Coproc *coproc;
 } Job;
 
+/* The wait status of an ended job's last stage, kept until `wait` asks. */
+typedef struct JobDone {
+    int id;
+    int status;
+} JobDone;
+
+typedef struct JobPid {
+    pid_t pid;
+    Job *job;
+} JobPid;
+
 typedef struct Jobs {
-    Job *head;
+    Job **table;
+    int cap;
+    int count;
+    int *free_ids;
+    int nfree;
+
+    JobPid *pidmap;
+    size_t pidcap;
+    size_t npids;
+
+    Coproc *detached;
+
+    JobDone *done;
+    int ndone;
+    int donecap;
+    int last_id;
 } Jobs;
 
 void jobs_init(Jobs *jobs);
-int jobs_add(Jobs *jobs, pid_t pid, const char *cmdline);
-char *jobs_take_cmdline(Jobs *jobs, pid_t pid);
+Job *jobs_add(Jobs *jobs, pid_t pgid, const pid_t *pids, int npids, const char *cmdline);
+Job *jobs_get(Jobs *jobs, int id);
+Job *jobs_find_pid(Jobs *jobs, pid_t pid);
+Coproc *jobs_find_coproc(Jobs *jobs, const char *name);
+int jobs_drop_coproc(Jobs *jobs, Coproc *co);
+void jobs_set_attrs(Job *job, const char *attrs);
+int jobs_live(const Jobs *jobs);
+int jobs_take_status(Jobs *jobs, int id, int *status);
+void jobs_forget_done(Jobs *jobs);
+void jobs_remove(Jobs *jobs, Job *job);
+int jobs_reap(Jobs *jobs, const Reaped *r, int log_fd);
+int jobs_handle_reaped(Jobs *jobs, int reap_fd, int log_fd);
+int jobs_signal(Job *job, int sig);
 void jobs_cleanup(Jobs *jobs);
 
 #endif
-
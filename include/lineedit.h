@@ -0,0 +1,41 @@
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+#include <stddef.h>
+#include <termios.h>
+#include "arena.h"
+
+typedef struct LineEdit {
+    int fd;
+    struct termios cooked;
+
+    char *buf;
+    size_t len;
+    size_t pos;
+    size_t cap;
+
+    char in[64];
+    size_t in_pos;
+    size_t in_len;
+
+    const char *prompt;
+    long hist;
+    char *stash;
+    int last_tab;
+    int interrupted;
+
+    Arena words;
+    const char **cands;
+    size_t ncands;
+    size_t skip;
+    size_t cands_cap;
+
+    int (*wait)(void *ctx, int fd);
+    void *wait_ctx;
+} LineEdit;
+
+int lineedit_init(LineEdit *le, int fd);
+const char *lineedit_read(LineEdit *le, const char *prompt, size_t *out_len);
+void lineedit_free(LineEdit *le);
+
+#endif
@@ -2,10 +2,22 @@
 #define LOGGER_H
 
 #include <sys/types.h>
+#include "usage.h"
+
+typedef struct LogRecord {
+    pid_t pid;
+    const char *cmdline;
+    const int *statuses;
+    int nstages;
+    long lineno;
+    const Usage *usage;
+    const char *attrs;
+} LogRecord;
 
 int logger_open(const char *path);
 void logger_log(int fd, pid_t pid, const char *cmdline, int status);
+void logger_not_found(int fd, const char *cmdline, long lineno);
+void logger_write(int fd, const LogRecord *rec);
 void logger_close(int fd);
 
 #endif
-
@@ -1,24 +1,109 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+#include <stddef.h>
+
+struct Arena;
+
+#define PARSE_INCOMPLETE "unexpected end of input"
+
+/* A line parses to a pipeline or to a tree of these nodes:
+ *   CMD_SEQ, CMD_AND, CMD_OR   left ; right, left && right, left || right
+ *   CMD_IF                     if left then right else alt fi
+ *   CMD_WHILE, CMD_UNTIL       while left do right done
+ *   CMD_FOR                    for var in argv... do right done */
+enum {
+    CMD_PIPELINE = 0,
+    CMD_SEQ,
+    CMD_AND,
+    CMD_OR,
+    CMD_IF,
+    CMD_WHILE,
+    CMD_UNTIL,
+    CMD_FOR
+};
+
+/* Redirections in the order written. A stage that uses anything beyond plain
+ * < > >> keeps all of its redirections here and leaves in_file/out_file
+ * NULL:
+ *   REDIR_IN, REDIR_OUT, REDIR_APPEND   fd <, >, >> target
+ *   REDIR_DUP                           fd >& dup_fd, or closed when dup_fd < 0
+ *   REDIR_DATA                          fd reads target (<<EOF body, <<< word) */
+enum {
+    REDIR_IN = 0,
+    REDIR_OUT,
+    REDIR_APPEND,
+    REDIR_DUP,
+    REDIR_DATA
+};
+
+typedef struct Redir {
+    int kind;
+    int fd;
+    int dup_fd;
+    char *target;
+    int expand;
+} Redir;
+
 typedef struct Command {
+    int kind;
+
     char **argv;
     int argc;
 
+    /* Leading NAME=value words, and whether any word holds a $ to expand. */
+    char **assign;
+    int nassign;
+    int expand;
+
     char *in_file;
     char *out_file;
     int out_append;
 
+    Redir *redirs;
+    int nredirs;
+
     int background;
+    int timed;
 
     int has_pipe;
     struct Command *pipe_cmd;
 
     char *rawline;
+
+    struct Command *left;
+    struct Command *right;
+    struct Command *alt;
+    char *var;
+
+    struct Arena *arena;
+    int refs;
 } Command;
 
+/* Lines of a block or here-document that is not closed yet. */
+typedef struct Pending {
+    char *buf;
+    size_t len;
+    size_t cap;
+} Pending;
+
+typedef struct ParseStats {
+    unsigned long lines;
+    unsigned long mallocs;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long cached;
+    size_t cache_bytes;
+} ParseStats;
+
 Command *parse_line(const char *line, const char **err_msg);
+Command *parse_line_n(const char *line, size_t len, const char **err_msg);
 void free_command(Command *cmd);
+Command *pending_parse(Pending *p, const char *line, size_t len, const char **err_msg);
+void parse_get_stats(ParseStats *st);
+int parse_set_cache(const char *size);
+char *parse_expand_word(struct Arena *a, const char *word, int status);
+Command *parse_expand(struct Arena *a, Command *cmd, int status);
 
 #endif
 
@@ -0,0 +1,13 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include <stddef.h>
+
+const char *pathcache_lookup(const char *name);
+char *pathcache_search(const char *name, const char *path);
+void pathcache_forget(const char *name);
+void pathcache_reset(void);
+void pathcache_list(void);
+size_t pathcache_complete(const char *prefix, void (*fn)(const char *name, void *ctx), void *ctx);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+#include "jobs.h"
+#include <sys/types.h>
+
+typedef struct Shell {
+    Jobs jobs;
+    int log_fd;
+    int reap_fd;
+    int status;
+
+    int job_control;
+    int tty_fd;
+    pid_t pgid;
+} Shell;
+
+#endif
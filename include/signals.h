@@ -3,14 +3,22 @@
 
 #include <sys/types.h>
 #include <stddef.h>
+#include <time.h>
+#include <sys/resource.h>
 
 typedef struct Reaped {
     pid_t pid;
     int status;
+    struct rusage ru;
+    struct timespec end;
 } Reaped;
 
-int signals_init(int sigchld_pipe[2]);
-ssize_t signals_read_reaped(int fd, Reaped *buf, size_t max);
+int signals_init(void);
+int signals_job_control(int tty_fd, pid_t *shell_pgid);
+size_t signals_read_reaped(int fd, Reaped *buf, size_t max);
+void signals_catch_int(int on);
+void signals_break_int(int on);
+int signals_interrupted(void);
 
 #endif
 
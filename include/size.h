@@ -0,0 +1,6 @@
+#ifndef SIZE_H
+#define SIZE_H
+
+long long size_parse(const char *s);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef TOKENIZE_H
+#define TOKENIZE_H
+
+#include <stddef.h>
+#include "arena.h"
+
+enum {
+    TOK_WORD = 0,
+    TOK_IN,
+    TOK_OUT,
+    TOK_APPEND,
+    TOK_PIPE,
+    TOK_AMP,
+    TOK_AND,
+    TOK_OR,
+    TOK_SEMI,
+    TOK_NL,
+    TOK_HEREDOC,
+    TOK_HERESTR,
+    TOK_DUP_IN,
+    TOK_DUP_OUT,
+    TOK_BODY
+};
+
+typedef struct Token {
+    unsigned int off;
+    unsigned int len;
+    int kind;
+} Token;
+
+int tokenize_slices(Arena *a, const char *s, size_t n, Token **out_tokens, int *out_n);
+int tokenize_ref(Arena *a, const char *s, Token **out_tokens, int *out_n);
+
+int tokenize_set_impl(const char *name);
+const char *tokenize_impl_name(void);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef USAGE_H
+#define USAGE_H
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+typedef struct Usage {
+    struct timespec start;
+    struct timespec end;
+    struct rusage ru;
+} Usage;
+
+void usage_begin(Usage *u);
+void usage_add(Usage *u, const struct rusage *ru, const struct timespec *end);
+void usage_end_self(Usage *u, const struct rusage *before);
+double usage_wall(const Usage *u);
+double usage_seconds(const struct timeval *tv);
+void usage_print(FILE *f, const Usage *u);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+enum {
+    VARS_KEEP = -1
+};
+
+int vars_init(char **env);
+const char *vars_get(const char *name);
+const char *vars_get_n(const char *name, size_t len);
+int vars_set(const char *name, const char *value, int exported);
+int vars_assign(const char *word, int exported);
+int vars_unset(const char *name);
+int vars_valid_name(const char *s, size_t len);
+char **vars_envp(void);
+void vars_list(FILE *out, int exported_only);
+
+size_t vars_push(char **words, int n);
+void vars_pop(size_t mark);
+
+#endif
@@ -0,0 +1,83 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_BLOCK 4096
+
+static size_t align_up(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static char *block_data(ArenaBlock *b) {
+    return (char *)b + align_up(sizeof(ArenaBlock));
+}
+
+void arena_init(Arena *a) {
+    a->head = NULL;
+    a->mallocs = 0;
+}
+
+void *arena_alloc(Arena *a, size_t n) {
+    n = align_up(n ? n : 1);
+
+    ArenaBlock *b = a->head;
+    if (!b || b->size - b->used < n) {
+        size_t size = (n > ARENA_BLOCK) ? n : ARENA_BLOCK;
+        b = (ArenaBlock *)malloc(align_up(sizeof(ArenaBlock)) + size);
+        if (!b) return NULL;
+        a->mallocs++;
+        b->size = size;
+        b->used = 0;
+        b->next = a->head;
+        a->head = b;
+    }
+
+    void *p = block_data(b) + b->used;
+    b->used += n;
+    return p;
+}
+
+char *arena_strndup(Arena *a, const char *s, size_t n) {
+    char *p = (char *)arena_alloc(a, n + 1);
+    if (!p) return NULL;
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+void arena_reset(Arena *a) {
+    ArenaBlock *keep = NULL;
+    ArenaBlock *b = a->head;
+    while (b) {
+        ArenaBlock *next = b->next;
+        if (!keep || b->size > keep->size) {
+            free(keep);
+            keep = b;
+        } else {
+            free(b);
+        }
+        b = next;
+    }
+    if (keep) {
+        keep->used = 0;
+        keep->next = NULL;
+    }
+    a->head = keep;
+}
+
+size_t arena_size(const Arena *a) {
+    size_t n = 0;
+    for (const ArenaBlock *b = a->head; b; b = b->next) n += align_up(sizeof(ArenaBlock)) + b->size;
+    return n;
+}
+
+void arena_free(Arena *a) {
+    ArenaBlock *b = a->head;
+    while (b) {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = NULL;
+}
@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+#include "attrs.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+    const char *name;
+    int resource;
+    int bytes;
+} limit_names[ATTRS_NLIMITS] = {
+    { "mem", RLIMIT_AS, 1 },
+    { "data", RLIMIT_DATA, 1 },
+    { "stack", RLIMIT_STACK, 1 },
+    { "fsize", RLIMIT_FSIZE, 1 },
+    { "core", RLIMIT_CORE, 1 },
+    { "nofile", RLIMIT_NOFILE, 0 },
+    { "nproc", RLIMIT_NPROC, 0 },
+    { "cputime", RLIMIT_CPU, 0 },
+};
+
+static Attrs g_session;
+
+Attrs *attrs_session(void) {
+    return &g_session;
+}
+
+int attrs_any(const Attrs *a) {
+    return a->has_cpus || a->has_nice || a->limits_set;
+}
+
+int attrs_set_cpus(Attrs *a, const char *who, const char *list) {
+    if (strcmp(list, "inherit") == 0) {
+        a->has_cpus = 0;
+        return 0;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        long hi = lo;
+        if (end == p || lo < 0) break;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p || hi < lo) break;
+        }
+        if (hi >= CPU_SETSIZE) break;
+        for (long c = lo; c <= hi; c++) CPU_SET((int)c, &set);
+        p = end;
+        if (*p == ',') p++;
+        else if (*p) break;
+    }
+    if (*p || CPU_COUNT(&set) == 0) {
+        fprintf(stderr, "myshell: %s: %s: invalid CPU list\n", who, list);
+        return -1;
+    }
+    a->cpus = set;
+    a->has_cpus = 1;
+    return 0;
+}
+
+int attrs_set_nice(Attrs *a, const char *who, const char *value) {
+    if (strcmp(value, "inherit") == 0) {
+        a->has_nice = 0;
+        return 0;
+    }
+    char *end;
+    long n = strtol(value, &end, 10);
+    if (end == value || *end || n < -20 || n > 19) {
+        fprintf(stderr, "myshell: %s: %s: nice must be -20..19\n", who, value);
+        return -1;
+    }
+    a->nice = (int)n;
+    a->has_nice = 1;
+    return 0;
+}
+
+static int parse_limit(const char *value, int bytes, rlim_t *out) {
+    if (strcmp(value, "unlimited") == 0) {
+        *out = RLIM_INFINITY;
+        return 0;
+    }
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(value, &end, 10);
+    if (end == value || value[0] == '-' || errno) return -1;
+    int shift = 0;
+    if (bytes && *end) {
+        switch (*end) {
+        case 'k': case 'K': shift = 10; break;
+        case 'm': case 'M': shift = 20; break;
+        case 'g': case 'G': shift = 30; break;
+        case 't': case 'T': shift = 40; break;
+        default: return -1;
+        }
+        end++;
+    }
+    if (*end || v > (~0ULL >> shift)) return -1;
+    *out = (rlim_t)(v << shift);
+    return 0;
+}
+
+/* Takes NAME=VALUE for cpus, nice or one of the limits; VALUE inherit drops
+ * the setting again. */
+int attrs_set(Attrs *a, const char *who, const char *word) {
+    const char *eq = strchr(word, '=');
+    if (!eq || eq[1] == '\0') {
+        fprintf(stderr, "myshell: %s: %s: expected NAME=VALUE\n", who, word);
+        return -1;
+    }
+    size_t len = (size_t)(eq - word);
+    const char *value = eq + 1;
+    if (len == 4 && strncmp(word, "cpus", 4) == 0) return attrs_set_cpus(a, who, value);
+    if (len == 4 && strncmp(word, "nice", 4) == 0) return attrs_set_nice(a, who, value);
+
+    for (int i = 0; i < ATTRS_NLIMITS; i++) {
+        if (strlen(limit_names[i].name) != len || strncmp(word, limit_names[i].name, len) != 0) continue;
+        if (strcmp(value, "inherit") == 0) {
+            a->limits_set &= ~(1u << i);
+            return 0;
+        }
+        if (parse_limit(value, limit_names[i].bytes, &a->limits[i]) < 0) {
+            fprintf(stderr, "myshell: %s: %s: invalid limit\n", who, word);
+            return -1;
+        }
+        a->limits_set |= 1u << i;
+        return 0;
+    }
+    fprintf(stderr, "myshell: %s: %.*s: unknown attribute\n", who, (int)len, word);
+    return -1;
+}
+
+static void append(char *buf, size_t n, size_t *len, const char *fmt, ...) {
+    if (*len >= n) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int w = vsnprintf(buf + *len, n - *len, fmt, ap);
+    va_end(ap);
+    if (w > 0) *len += (size_t)w;
+    if (*len >= n) *len = n - 1;
+}
+
+static void format_cpus(const cpu_set_t *set, char *buf, size_t n, size_t *len) {
+    int first = 1;
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (!CPU_ISSET(c, set)) continue;
+        int hi = c;
+        while (hi + 1 < CPU_SETSIZE && CPU_ISSET(hi + 1, set)) hi++;
+        append(buf, n, len, first ? "%d" : ",%d", c);
+        if (hi > c) append(buf, n, len, "-%d", hi);
+        first = 0;
+        c = hi;
+    }
+}
+
+static void format_limit(rlim_t v, int bytes, char *buf, size_t n, size_t *len) {
+    if (v == RLIM_INFINITY) {
+        append(buf, n, len, "unlimited");
+        return;
+    }
+    static const char units[] = "KMGT";
+    int u = -1;
+    while (bytes && u < 3 && v && (v & 1023) == 0) {
+        v >>= 10;
+        u++;
+    }
+    append(buf, n, len, "%llu", (unsigned long long)v);
+    if (u >= 0) append(buf, n, len, "%c", units[u]);
+}
+
+/* Writes the set parts as space-separated NAME=VALUE words, the form attrs_set
+ * reads back. */
+void attrs_describe(const Attrs *a, char *buf, size_t n) {
+    size_t len = 0;
+    buf[0] = '\0';
+    if (a->has_cpus) {
+        append(buf, n, &len, "cpus=");
+        format_cpus(&a->cpus, buf, n, &len);
+    }
+    if (a->has_nice) append(buf, n, &len, len ? " nice=%d" : "nice=%d", a->nice);
+    for (int i = 0; i < ATTRS_NLIMITS; i++) {
+        if (!(a->limits_set & (1u << i))) continue;
+        append(buf, n, &len, len ? " %s=" : "%s=", limit_names[i].name);
+        format_limit(a->limits[i], limit_names[i].bytes, buf, n, &len);
+    }
+}
+
+/* The CPUs launches may run on, marked when that is the shell's own set. */
+void attrs_print_cpus(FILE *out, const Attrs *a) {
+    cpu_set_t set = a->cpus;
+    if (!a->has_cpus && sched_getaffinity(0, sizeof(set), &set) < 0) {
+        perror("sched_getaffinity");
+        return;
+    }
+    char buf[1024];
+    size_t len = 0;
+    buf[0] = '\0';
+    format_cpus(&set, buf, sizeof(buf), &len);
+    fprintf(out, "%s%s\n", buf, a->has_cpus ? "" : " (inherited)");
+}
+
+/* One line per limit: the value launches get, marked when it is simply the
+ * shell's own. */
+void attrs_print_limits(FILE *out, const Attrs *a) {
+    for (int i = 0; i < ATTRS_NLIMITS; i++) {
+        int inherited = !(a->limits_set & (1u << i));
+        rlim_t v = a->limits[i];
+        if (inherited) {
+            struct rlimit r;
+            if (getrlimit(limit_names[i].resource, &r) < 0) continue;
+            v = r.rlim_cur;
+        }
+        char buf[32];
+        size_t len = 0;
+        buf[0] = '\0';
+        format_limit(v, limit_names[i].bytes, buf, sizeof(buf), &len);
+        fprintf(out, "%-8s %s%s\n", limit_names[i].name, buf, inherited ? " (inherited)" : "");
+    }
+}
+
+/* Runs in the child between fork and exec; reports the first failure. */
+int attrs_apply(const Attrs *a) {
+    for (int i = 0; i < ATTRS_NLIMITS; i++) {
+        if (!(a->limits_set & (1u << i))) continue;
+        struct rlimit r = { a->limits[i], a->limits[i] };
+        if (prlimit(0, limit_names[i].resource, &r, NULL) < 0) {
+            fprintf(stderr, "myshell: %s: %s\n", limit_names[i].name, strerror(errno));
+            return -1;
+        }
+    }
+    if (a->has_nice && setpriority(PRIO_PROCESS, 0, a->nice) < 0) {
+        fprintf(stderr, "myshell: nice: %s\n", strerror(errno));
+        return -1;
+    }
+    if (a->has_cpus && sched_setaffinity(0, sizeof(a->cpus), &a->cpus) < 0) {
+        fprintf(stderr, "myshell: cpus: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,331 @@
+#define _GNU_SOURCE
+#include "batch.h"
+#include "parse.h"
+#include "execute.h"
+#include "builtin.h"
+#include "signals.h"
+#include "logger.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/wait.h>
+
+typedef struct BatchJob {
+    long seq;
+    long lineno;
+    char *cmdline;
+    pid_t *pids;
+    int *statuses;
+    int npids;
+    int remaining;
+    int out_fd;
+    Usage usage;
+    char *attrs;
+} BatchJob;
+
+typedef struct Batch {
+    BatchJob *slots;
+    int nslots;
+    int used;
+    int running;
+    int njobs;
+    int ordered;
+    long next_seq;
+    long next_emit;
+    long fail_line;
+    int fail_status;
+    Shell *sh;
+} Batch;
+
+static char *xstrdup(const char *s) {
+    size_t n = strlen(s);
+    char *p = (char *)malloc(n + 1);
+    if (!p) return NULL;
+    memcpy(p, s, n + 1);
+    return p;
+}
+
+/* The batch exits with the status of the last line, in input order, that
+ * failed, so the result does not depend on which job finished first. */
+static void note_status(Batch *b, long lineno, int code) {
+    if (code != 0 && lineno >= b->fail_line) {
+        b->fail_line = lineno;
+        b->fail_status = code;
+    }
+}
+
+static void copy_out(int fd) {
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size <= 0) return;
+
+    off_t off = 0;
+    while (off < size) {
+        ssize_t w = sendfile(STDOUT_FILENO, fd, &off, (size_t)(size - off));
+        if (w > 0) continue;
+        if (w < 0 && errno == EINTR) continue;
+        break;
+    }
+    if (off >= size) return;
+
+    char buf[65536];
+    ssize_t r;
+    while ((r = pread(fd, buf, sizeof(buf), off)) > 0) {
+        if (write(STDOUT_FILENO, buf, (size_t)r) < 0) return;
+        off += r;
+    }
+}
+
+static void job_release(Batch *b, BatchJob *j) {
+    if (j->out_fd >= 0) close(j->out_fd);
+    free(j->cmdline);
+    free(j->attrs);
+    free(j->pids);
+    free(j->statuses);
+    memset(j, 0, sizeof(*j));
+    j->seq = -1;
+    j->out_fd = -1;
+    b->used--;
+}
+
+static void job_emit(Batch *b, BatchJob *j) {
+    fflush(stdout);
+    copy_out(j->out_fd);
+    job_release(b, j);
+}
+
+static void emit_ready(Batch *b) {
+    if (!b->ordered) {
+        for (int i = 0; i < b->nslots; i++) {
+            BatchJob *j = &b->slots[i];
+            if (j->seq >= 0 && j->remaining == 0) job_emit(b, j);
+        }
+        return;
+    }
+
+    for (;;) {
+        BatchJob *next = NULL;
+        for (int i = 0; i < b->nslots; i++) {
+            if (b->slots[i].seq == b->next_emit) next = &b->slots[i];
+        }
+        if (!next || next->remaining > 0) return;
+        job_emit(b, next);
+        b->next_emit++;
+    }
+}
+
+static void batch_reaped(Batch *b, const Reaped *r) {
+    pid_t pid = r->pid;
+    int status = r->status;
+    for (int i = 0; i < b->nslots; i++) {
+        BatchJob *j = &b->slots[i];
+        if (j->seq < 0) continue;
+        for (int k = 0; k < j->npids; k++) {
+            if (j->pids[k] != pid || j->statuses[k] != -1) continue;
+            if (WIFSTOPPED(status) || WIFCONTINUED(status)) return;
+            j->statuses[k] = status;
+            usage_add(&j->usage, &r->ru, &r->end);
+            if (--j->remaining == 0) {
+                LogRecord rec = { j->pids[0], j->cmdline, j->statuses, j->npids, j->lineno, &j->usage, j->attrs };
+                logger_write(b->sh->log_fd, &rec);
+                b->sh->status = execute_exit_code(j->statuses[j->npids - 1]);
+                note_status(b, j->lineno, b->sh->status);
+                b->running--;
+            }
+            return;
+        }
+    }
+    jobs_reap(&b->sh->jobs, r, b->sh->log_fd);
+}
+
+static void drain_reaped(Batch *b, int reap_fd) {
+    Reaped buf[32];
+    for (;;) {
+        size_t n = signals_read_reaped(reap_fd, buf, 32);
+        for (size_t i = 0; i < n; i++) batch_reaped(b, &buf[i]);
+        if (n < 32) return;
+    }
+}
+
+static BatchJob *free_slot(Batch *b) {
+    for (int i = 0; i < b->nslots; i++) {
+        if (b->slots[i].seq < 0) return &b->slots[i];
+    }
+    return NULL;
+}
+
+static void batch_start(Batch *b, Command *cmd, long lineno) {
+    BatchJob *j = free_slot(b);
+    int n = execute_stages(cmd);
+
+    j->pids = (pid_t *)calloc((size_t)n, sizeof(pid_t));
+    j->statuses = (int *)malloc(sizeof(int) * (size_t)n);
+    j->cmdline = xstrdup(cmd->rawline);
+    j->out_fd = memfd_create("myshell-batch", MFD_CLOEXEC);
+    if (!j->pids || !j->statuses || !j->cmdline || j->out_fd < 0) {
+        fprintf(stderr, "myshell: line %ld: cannot set up job\n", lineno);
+        free(j->pids);
+        free(j->statuses);
+        free(j->cmdline);
+        if (j->out_fd >= 0) close(j->out_fd);
+        memset(j, 0, sizeof(*j));
+        j->seq = -1;
+        j->out_fd = -1;
+        return;
+    }
+
+    j->seq = b->next_seq++;
+    j->lineno = lineno;
+    b->used++;
+
+    for (int i = 0; i < n; i++) j->statuses[i] = -1;
+
+    usage_begin(&j->usage);
+    const char *attrs = NULL;
+    int started = execute_start(cmd, j->out_fd, j->out_fd, j->pids, &attrs);
+    if (attrs) j->attrs = xstrdup(attrs);
+    if (started < 0) {
+        logger_not_found(b->sh->log_fd, cmd->rawline, lineno);
+        note_status(b, lineno, 127);
+        started = 0;
+    }
+    j->npids = started;
+    j->remaining = started;
+    if (started > 0) b->running++;
+}
+
+/* Runs a line the shell executes itself: a list, a loop or a builtin. With
+ * -k its output is captured in a slot of its own, like a job's, so it is
+ * written out in input order too. */
+static int batch_sync(Batch *b, Command *cmd, Command *run, long lineno) {
+    Shell *sh = b->sh;
+    int saved_out = -1;
+    int saved_err = -1;
+
+    if (b->ordered) {
+        BatchJob *j = free_slot(b);
+        j->out_fd = memfd_create("myshell-batch", MFD_CLOEXEC);
+        j->seq = b->next_seq++;
+        j->lineno = lineno;
+        b->used++;
+        if (j->out_fd >= 0) {
+            fflush(stdout);
+            saved_out = dup(STDOUT_FILENO);
+            saved_err = dup(STDERR_FILENO);
+            dup2(j->out_fd, STDOUT_FILENO);
+            dup2(j->out_fd, STDERR_FILENO);
+        }
+    }
+
+    int bi;
+    if (!run) bi = execute_line(sh, cmd) == BUILTIN_EXIT ? BUILTIN_EXIT : BUILTIN_HANDLED;
+    else bi = builtin_execute(sh, run);
+
+    if (saved_out >= 0) {
+        fflush(stdout);
+        dup2(saved_out, STDOUT_FILENO);
+        dup2(saved_err, STDERR_FILENO);
+        close(saved_out);
+        close(saved_err);
+    }
+    if (bi != BUILTIN_EXIT) note_status(b, lineno, sh->status);
+    return bi;
+}
+
+int batch_run(Shell *sh, Input *in, int njobs, int ordered) {
+    Batch b;
+    memset(&b, 0, sizeof(b));
+    b.njobs = njobs;
+    b.ordered = ordered;
+    b.nslots = ordered ? njobs * 2 : njobs;
+    b.sh = sh;
+    b.slots = (BatchJob *)calloc((size_t)b.nslots, sizeof(BatchJob));
+    if (!b.slots) {
+        fprintf(stderr, "myshell: out of memory\n");
+        return -1;
+    }
+    for (int i = 0; i < b.nslots; i++) {
+        b.slots[i].seq = -1;
+        b.slots[i].out_fd = -1;
+    }
+
+    Arena scratch;
+    arena_init(&scratch);
+
+    long lineno = 0;
+    long first = 0;
+    int done = 0;
+    int rc = 0;
+    Pending pending = { NULL, 0, 0 };
+
+    while (!done || b.used > 0) {
+        drain_reaped(&b, sh->reap_fd);
+        emit_ready(&b);
+
+        if (!done && b.running < b.njobs && b.used < b.nslots) {
+            size_t len;
+            const char *line = input_next(in, &len);
+            if (!line) {
+                if (pending.len) fprintf(stderr, "myshell: line %ld: %s\n", first, PARSE_INCOMPLETE);
+                done = 1;
+                continue;
+            }
+            lineno++;
+
+            /* A block or here-document spanning lines is one entry,
+             * numbered by its first line. */
+            if (!pending.len) first = lineno;
+            const char *err = NULL;
+            Command *cmd = pending_parse(&pending, line, len, &err);
+            if (!cmd) {
+                if (err && strcmp(err, PARSE_INCOMPLETE) != 0 && strcmp(err, "empty") != 0) {
+                    fprintf(stderr, "myshell: line %ld: %s\n", first, err);
+                }
+                continue;
+            }
+
+            /* Lists and loops run to completion here; only plain pipelines
+             * are spread over the job slots. */
+            Command *run = cmd->kind == CMD_PIPELINE ? parse_expand(&scratch, cmd, sh->status) : NULL;
+            if (run && run->argc == 0) run = NULL;
+
+            int bi = BUILTIN_NONE;
+            const Builtin *found = run ? builtin_for(run) : NULL;
+            if (!run || (found && !run->has_pipe && !(found->flags & BUILTIN_STAGE))) {
+                bi = batch_sync(&b, cmd, run, first);
+            }
+            if (bi == BUILTIN_EXIT) {
+                done = 1;
+                rc = BUILTIN_EXIT;
+            } else if (bi == BUILTIN_NONE) {
+                if (run->background) execute_command(sh, run);
+                else batch_start(&b, run, first);
+            }
+            free_command(cmd);
+            arena_reset(&scratch);
+            continue;
+        }
+
+        if (b.used == 0) continue;
+
+        struct pollfd pfd = { .fd = sh->reap_fd, .events = POLLIN, .revents = 0 };
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+    }
+
+    /* exit N keeps its own status; otherwise any failed line fails the batch. */
+    if (rc != BUILTIN_EXIT) sh->status = b.fail_status;
+
+    fflush(stdout);
+    free(pending.buf);
+    free(b.slots);
+    arena_free(&scratch);
+    return rc;
+}
@@ -1,30 +1,1281 @@
+#define _GNU_SOURCE
 #include "builtin.h"
+#include "execute.h"
+#include "pathcache.h"
+#include "logger.h"
+#include "usage.h"
+#include "fastcopy.h"
+#include "vars.h"
+#include "history.h"
+#include "attrs.h"
+#include "signals.h"
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/signalfd.h>
 
-int builtin_execute(Command *cmd) {
-    if (!cmd || cmd->argc == 0 || !cmd->argv || !cmd->argv[0]) return BUILTIN_NONE;
+static char *xstrdup(const char *s) {
+    size_t n = strlen(s);
+    char *p = (char *)malloc(n + 1);
+    if (!p) return NULL;
+    memcpy(p, s, n + 1);
+    return p;
+}
+
+static ssize_t write_all(int fd, const char *buf, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t w = write(fd, buf + done, n - done);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += (size_t)w;
+    }
+    return (ssize_t)done;
+}
+
+static Job *job_arg(Shell *sh, Command *cmd, const char *name) {
+    Job *j = NULL;
+    if (cmd->argc >= 2) {
+        const char *arg = cmd->argv[1];
+        if (arg[0] == '%') arg++;
+        j = jobs_get(&sh->jobs, atoi(arg));
+    } else {
+        for (int id = sh->jobs.count; id >= 1 && !j; id--) j = jobs_get(&sh->jobs, id);
+    }
+    if (!j) {
+        if (cmd->argc >= 2) fprintf(stderr, "myshell: %s: %s: no such job\n", name, cmd->argv[1]);
+        else fprintf(stderr, "myshell: %s: no current job\n", name);
+    }
+    return j;
+}
+
+static void wait_jobs(Shell *sh, int id) {
+    for (;;) {
+        jobs_handle_reaped(&sh->jobs, sh->reap_fd, sh->log_fd);
+        if (id ? !jobs_get(&sh->jobs, id) : jobs_live(&sh->jobs) == 0) return;
+
+        struct pollfd pfd = { .fd = sh->reap_fd, .events = POLLIN, .revents = 0 };
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+            perror("poll");
+            return;
+        }
+    }
+}
+
+/* Returns the status to exit with, the last command's by default, or -1 to
+ * keep running. */
+static int bi_exit(Shell *sh, Command *cmd) {
+    if (cmd->argc < 2) return sh->status;
+    if (cmd->argc > 2) {
+        fprintf(stderr, "myshell: %s: too many arguments\n", cmd->argv[0]);
+        return -1;
+    }
+    char *end;
+    long n = strtol(cmd->argv[1], &end, 10);
+    if (end == cmd->argv[1] || *end) {
+        fprintf(stderr, "myshell: %s: %s: numeric argument required\n", cmd->argv[0], cmd->argv[1]);
+        return 2;
+    }
+    return (int)(n & 0xff);
+}
+
+static int bi_cd(Shell *sh, Command *cmd) {
+    (void)sh;
+    const char *path = NULL;
+    if (cmd->argc >= 2) path = cmd->argv[1];
+    if (!path || path[0] == '\0') path = vars_get("HOME");
+    if (!path) {
+        fprintf(stderr, "myshell: cd: HOME not set\n");
+        return 1;
+    }
+    if (chdir(path) < 0) {
+        perror("cd");
+        return 1;
+    }
+    return 0;
+}
+
+static int bi_jobs(Shell *sh, Command *cmd) {
+    (void)cmd;
+    jobs_handle_reaped(&sh->jobs, sh->reap_fd, sh->log_fd);
+    for (int id = 1; id <= sh->jobs.count; id++) {
+        Job *j = jobs_get(&sh->jobs, id);
+        if (j) printf("[%d] %-8s %s\n", j->id, j->stopped ? "Stopped" : "Running", j->cmdline);
+    }
+    return 0;
+}
+
+/* Returns the waited job's status, decoded like a foreground job's; with no
+ * argument, that of the job started last. A job that already ended is
+ * still reported until it has been waited for. */
+static int bi_wait(Shell *sh, Command *cmd) {
+    int status = 0;
+    if (cmd->argc < 2) {
+        int last = sh->jobs.last_id;
+        wait_jobs(sh, 0);
+        if (last) jobs_take_status(&sh->jobs, last, &status);
+        jobs_forget_done(&sh->jobs);
+        return execute_exit_code(status);
+    }
+
+    const char *arg = cmd->argv[1];
+    if (arg[0] == '%') arg++;
+    int id = atoi(arg);
+    if (jobs_get(&sh->jobs, id)) wait_jobs(sh, id);
+    if (jobs_take_status(&sh->jobs, id, &status) == 0) return execute_exit_code(status);
+    if (jobs_get(&sh->jobs, id)) return 1;
+    fprintf(stderr, "myshell: wait: %s: no such job\n", cmd->argv[1]);
+    return 127;
+}
+
+static int bi_fg(Shell *sh, Command *cmd) {
+    Job *j = job_arg(sh, cmd, "fg");
+    if (!j) return 1;
+    execute_foreground(sh, j->id);
+    return 0;
+}
+
+static int bi_bg(Shell *sh, Command *cmd) {
+    Job *j = job_arg(sh, cmd, "bg");
+    if (!j) return 1;
+    jobs_signal(j, SIGCONT);
+    j->stopped = 0;
+    printf("[%d] %s\n", j->id, j->cmdline);
+    return 0;
+}
+
+static int bi_hash(Shell *sh, Command *cmd) {
+    (void)sh;
+    if (cmd->argc == 1) {
+        pathcache_list();
+        return 0;
+    }
+    int rc = 0;
+    for (int i = 1; i < cmd->argc; i++) {
+        if (strcmp(cmd->argv[i], "-r") == 0) {
+            pathcache_reset();
+        } else if (!pathcache_lookup(cmd->argv[i])) {
+            fprintf(stderr, "myshell: hash: %s: not found\n", cmd->argv[i]);
+            rc = 1;
+        }
+    }
+    return rc;
+}
+
+static void print_pipesize(void) {
+    if (execute_pipesize()) printf("pipesize %d\n", execute_pipesize());
+    else printf("pipesize default\n");
+}
+
+static int set_pipesize(const char *arg) {
+    int capped;
+    int granted = execute_set_pipesize(arg, &capped);
+    if (granted < 0) {
+        fprintf(stderr, "myshell: set: pipesize %s: %s\n", arg, errno ? strerror(errno) : "invalid size");
+        return 1;
+    }
+    if (capped) fprintf(stderr, "myshell: set: pipesize capped by /proc/sys/fs/pipe-max-size\n");
+    print_pipesize();
+    return 0;
+}
+
+static void print_nice(void) {
+    const Attrs *a = attrs_session();
+    if (a->has_nice) printf("nice %d\n", a->nice);
+    else printf("nice inherit\n");
+}
+
+static int bi_set(Shell *sh, Command *cmd) {
+    (void)sh;
+    if (cmd->argc == 1) {
+        printf("launch %s\n", execute_launch_name());
+        print_pipesize();
+        print_nice();
+        return 0;
+    }
+    if (strcmp(cmd->argv[1], "nice") == 0) {
+        if (cmd->argc < 3) {
+            print_nice();
+            return 0;
+        }
+        return attrs_set_nice(attrs_session(), "set", cmd->argv[2]) < 0 ? 1 : 0;
+    }
+    if (strcmp(cmd->argv[1], "pipesize") == 0) {
+        if (cmd->argc < 3) {
+            print_pipesize();
+            return 0;
+        }
+        errno = 0;
+        return set_pipesize(cmd->argv[2]);
+    }
+    if (strcmp(cmd->argv[1], "launch") == 0) {
+        if (cmd->argc < 3) {
+            printf("launch %s\n", execute_launch_name());
+        } else if (execute_set_launch(cmd->argv[2]) < 0) {
+            fprintf(stderr, "myshell: set: launch must be fork or spawn\n");
+            return 1;
+        }
+        return 0;
+    }
+    fprintf(stderr, "myshell: set: unknown option %s\n", cmd->argv[1]);
+    return 2;
+}
+
+/* Session limits only reach launched commands; the shell keeps its own. */
+static int bi_ulimit(Shell *sh, Command *cmd) {
+    (void)sh;
+    if (cmd->argc == 1) {
+        attrs_print_limits(stdout, attrs_session());
+        return 0;
+    }
+    Attrs next = *attrs_session();
+    for (int i = 1; i < cmd->argc; i++) {
+        const char *w = cmd->argv[i];
+        if (strncmp(w, "cpus=", 5) == 0 || strncmp(w, "nice=", 5) == 0) {
+            fprintf(stderr, "myshell: ulimit: %s: not a limit (see affinity and set nice)\n", w);
+            return 2;
+        }
+        if (attrs_set(&next, "ulimit", w) < 0) return 2;
+    }
+    *attrs_session() = next;
+    return 0;
+}
+
+static int bi_affinity(Shell *sh, Command *cmd) {
+    (void)sh;
+    if (cmd->argc == 1) {
+        attrs_print_cpus(stdout, attrs_session());
+        return 0;
+    }
+    return attrs_set_cpus(attrs_session(), "affinity", cmd->argv[1]) < 0 ? 2 : 0;
+}
+
+static int bi_export(Shell *sh, Command *cmd) {
+    (void)sh;
+    if (cmd->argc == 1) {
+        vars_list(stdout, 1);
+        return 0;
+    }
+    int rc = 0;
+    for (int i = 1; i < cmd->argc; i++) {
+        const char *w = cmd->argv[i];
+        const char *eq = strchr(w, '=');
+        if (!vars_valid_name(w, eq ? (size_t)(eq - w) : strlen(w))) {
+            fprintf(stderr, "myshell: export: %s: not a valid identifier\n", w);
+            rc = 1;
+        } else if (eq) {
+            vars_assign(w, 1);
+        } else {
+            const char *value = vars_get(w);
+            vars_set(w, value ? value : "", 1);
+        }
+    }
+    return rc;
+}
+
+static int bi_unset(Shell *sh, Command *cmd) {
+    (void)sh;
+    int rc = 0;
+    for (int i = 1; i < cmd->argc; i++) {
+        if (!vars_valid_name(cmd->argv[i], strlen(cmd->argv[i]))) {
+            fprintf(stderr, "myshell: unset: %s: not a valid identifier\n", cmd->argv[i]);
+            rc = 1;
+            continue;
+        }
+        vars_unset(cmd->argv[i]);
+    }
+    return rc;
+}
+
+static int bi_coproc(Shell *sh, Command *cmd) {
+    if (cmd->argc < 3 || !vars_valid_name(cmd->argv[1], strlen(cmd->argv[1]))) {
+        fprintf(stderr, "myshell: usage: coproc NAME command [args...]\n");
+        return 2;
+    }
+    const char *name = cmd->argv[1];
+    Coproc *old = jobs_find_coproc(&sh->jobs, name);
+    if (old && jobs_drop_coproc(&sh->jobs, old) < 0) {
+        fprintf(stderr, "myshell: coproc: %s: already running\n", name);
+        return 1;
+    }
+
+    /* Redirections on the coproc line are already on the shell's fds, so
+     * the command only needs its words. */
+    Command sub;
+    memset(&sub, 0, sizeof(sub));
+    sub.kind = cmd->kind;
+    sub.argv = cmd->argv + 2;
+    sub.argc = cmd->argc - 2;
+    sub.background = 1;
+    sub.rawline = cmd->rawline;
+
+    Coproc *co = (Coproc *)calloc(1, sizeof(Coproc));
+    if (co) co->name = xstrdup(name);
+    if (!co || !co->name) {
+        free(co);
+        return 1;
+    }
+
+    Job *j = execute_coproc(sh, &sub, co);
+    if (!j) {
+        free(co->name);
+        free(co);
+        return 1;
+    }
+    fcntl(co->from_fd, F_SETFL, O_NONBLOCK);
+
+    char var[256], val[32];
+    snprintf(var, sizeof(var), "%s_PID", name);
+    snprintf(val, sizeof(val), "%d", (int)j->pids[0]);
+    vars_set(var, val, 0);
+    return 0;
+}
+
+static Coproc *coproc_arg(Shell *sh, Command *cmd, int min_args) {
+    if (cmd->argc < min_args) {
+        fprintf(stderr, "myshell: %s: missing coprocess name\n", cmd->argv[0]);
+        return NULL;
+    }
+    Coproc *co = jobs_find_coproc(&sh->jobs, cmd->argv[1]);
+    if (!co) fprintf(stderr, "myshell: %s: %s: no such coprocess\n", cmd->argv[0], cmd->argv[1]);
+    return co;
+}
+
+static int bi_cowrite(Shell *sh, Command *cmd) {
+    Coproc *co = coproc_arg(sh, cmd, 2);
+    if (!co) return 1;
+    if (co->to_fd < 0) {
+        fprintf(stderr, "myshell: cowrite: %s: input is closed\n", co->name);
+        return 1;
+    }
+
+    size_t len = 0;
+    for (int i = 2; i < cmd->argc; i++) len += strlen(cmd->argv[i]) + 1;
+    char *line = (char *)malloc(len + 1);
+    if (!line) return 1;
+    char *p = line;
+    for (int i = 2; i < cmd->argc; i++) {
+        size_t n = strlen(cmd->argv[i]);
+        memcpy(p, cmd->argv[i], n);
+        p += n;
+        *p++ = (i + 1 < cmd->argc) ? ' ' : '\n';
+    }
+    if (p == line) *p++ = '\n';
+
+    /* A coprocess that has exited must not take the shell down with it. */
+    struct sigaction ign, old;
+    memset(&ign, 0, sizeof(ign));
+    ign.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ign, &old);
+    int rc = 0;
+    if (write_all(co->to_fd, line, (size_t)(p - line)) < 0) {
+        fprintf(stderr, "myshell: cowrite: %s: %s\n", co->name, strerror(errno));
+        rc = 1;
+    }
+    sigaction(SIGPIPE, &old, NULL);
+    free(line);
+    return rc;
+}
+
+/* Waits for fd to become readable; Ctrl-C gives up the wait. */
+static int wait_readable(int fd) {
+    sigset_t intr, old;
+    sigemptyset(&intr);
+    sigaddset(&intr, SIGINT);
+    sigprocmask(SIG_BLOCK, &intr, &old);
+    int sfd = signalfd(-1, &intr, SFD_CLOEXEC);
+
+    int rc = 0;
+    struct pollfd p[2] = { { fd, POLLIN, 0 }, { sfd, POLLIN, 0 } };
+    while (poll(p, sfd >= 0 ? 2 : 1, -1) < 0) {
+        if (errno != EINTR) {
+            rc = -1;
+            break;
+        }
+    }
+    if (sfd >= 0 && (p[1].revents & POLLIN)) {
+        struct signalfd_siginfo si;
+        if (read(sfd, &si, sizeof(si)) > 0) {
+            fputc('\n', stderr);
+            rc = 128 + SIGINT;
+        }
+    }
+    if (sfd >= 0) close(sfd);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return rc;
+}
+
+static int bi_coread(Shell *sh, Command *cmd) {
+    Coproc *co = coproc_arg(sh, cmd, 2);
+    if (!co) return 1;
+
+    char *nl = NULL;
+    while (co->end == co->start || !(nl = (char *)memchr(co->buf + co->start, '\n', co->end - co->start))) {
+        if (co->start > 0) {
+            memmove(co->buf, co->buf + co->start, co->end - co->start);
+            co->end -= co->start;
+            co->start = 0;
+        }
+        if (co->end == co->cap) {
+            size_t cap = co->cap ? co->cap * 2 : 4096;
+            char *buf = (char *)realloc(co->buf, cap);
+            if (!buf) return 1;
+            co->buf = buf;
+            co->cap = cap;
+        }
+        ssize_t r = read(co->from_fd, co->buf + co->end, co->cap - co->end);
+        if (r > 0) {
+            co->end += (size_t)r;
+        } else if (r == 0) {
+            if (co->end == 0) {
+                /* Everything an exited coprocess wrote has been read. */
+                jobs_drop_coproc(&sh->jobs, co);
+                return 1;
+            }
+            nl = co->buf + co->end;
+            break;
+        } else if (errno == EAGAIN) {
+            int rc = wait_readable(co->from_fd);
+            if (rc) return rc < 0 ? 1 : rc;
+        } else if (errno != EINTR) {
+            fprintf(stderr, "myshell: coread: %s: %s\n", co->name, strerror(errno));
+            return 1;
+        }
+    }
 
-    if (strcmp(cmd->argv[0], "exit") == 0 || strcmp(cmd->argv[0], "quit") == 0) {
-        return BUILTIN_EXIT;
+    char *line = co->buf + co->start;
+    size_t len = (size_t)(nl - line);
+    co->start = (nl < co->buf + co->end) ? co->start + len + 1 : co->end;
+    if (co->start == co->end) co->start = co->end = 0;
+
+    if (cmd->argc < 3) {
+        fwrite(line, 1, len, stdout);
+        putchar('\n');
+        return 0;
+    }
+    if (!vars_valid_name(cmd->argv[2], strlen(cmd->argv[2]))) {
+        fprintf(stderr, "myshell: coread: %s: not a valid identifier\n", cmd->argv[2]);
+        return 1;
     }
+    char *val = (char *)malloc(len + 1);
+    if (!val) return 1;
+    memcpy(val, line, len);
+    val[len] = '\0';
+    vars_set(cmd->argv[2], val, 0);
+    free(val);
+    return 0;
+}
+
+static int bi_coclose(Shell *sh, Command *cmd) {
+    Coproc *co = coproc_arg(sh, cmd, 2);
+    if (!co) return 1;
+    if (co->to_fd >= 0) close(co->to_fd);
+    co->to_fd = -1;
+    return 0;
+}
 
-    if (strcmp(cmd->argv[0], "cd") == 0) {
-        const char *path = NULL;
-        if (cmd->argc >= 2) path = cmd->argv[1];
-        if (!path || path[0] == '\0') path = getenv("HOME");
-        if (!path) {
-            fprintf(stderr, "myshell: cd: HOME not set\n");
-            return BUILTIN_HANDLED;
+static int bi_history(Shell *sh, Command *cmd) {
+    (void)sh;
+    size_t count = history_count();
+    size_t first = 0;
+    if (cmd->argc > 1) {
+        char *end;
+        long n = strtol(cmd->argv[1], &end, 10);
+        if (end == cmd->argv[1] || *end || n < 0) {
+            fprintf(stderr, "myshell: history: %s: numeric argument required\n", cmd->argv[1]);
+            return 2;
         }
-        if (chdir(path) < 0) {
-            perror("cd");
+        if ((size_t)n < count) first = count - (size_t)n;
+    }
+    for (size_t i = first; i < count; i++) {
+        size_t len;
+        const char *e = history_get(i, &len);
+        printf("%5zu  %.*s\n", i + 1, (int)len, e);
+    }
+    return 0;
+}
+
+static int bi_true(Shell *sh, Command *cmd) {
+    (void)sh;
+    (void)cmd;
+    return 0;
+}
+
+static int bi_false(Shell *sh, Command *cmd) {
+    (void)sh;
+    (void)cmd;
+    return 1;
+}
+
+static int bi_pwd(Shell *sh, Command *cmd) {
+    (void)sh;
+    (void)cmd;
+    char buf[PATH_MAX];
+    if (!getcwd(buf, sizeof(buf))) {
+        perror("pwd");
+        return 1;
+    }
+    puts(buf);
+    return 0;
+}
+
+/* Writes one backslash escape starting after the backslash and returns the
+ * number of characters consumed, or -1 for \c (stop all output). */
+static int put_escape(const char *s) {
+    switch (*s) {
+    case 'n': putchar('\n'); return 1;
+    case 't': putchar('\t'); return 1;
+    case 'r': putchar('\r'); return 1;
+    case 'a': putchar('\a'); return 1;
+    case 'b': putchar('\b'); return 1;
+    case 'f': putchar('\f'); return 1;
+    case 'v': putchar('\v'); return 1;
+    case 'e': putchar('\033'); return 1;
+    case '\\': putchar('\\'); return 1;
+    case 'c': return -1;
+    case '0': {
+        int v = 0, n = 1;
+        while (n < 4 && s[n] >= '0' && s[n] <= '7') v = v * 8 + (s[n++] - '0');
+        putchar(v);
+        return n;
+    }
+    case '\0':
+        putchar('\\');
+        return 0;
+    default:
+        putchar('\\');
+        putchar(*s);
+        return 1;
+    }
+}
+
+static int put_escaped(const char *s) {
+    while (*s) {
+        if (*s != '\\') {
+            putchar(*s++);
+            continue;
         }
-        return BUILTIN_HANDLED;
+        int n = put_escape(s + 1);
+        if (n < 0) return -1;
+        s += 1 + n;
     }
+    return 0;
+}
 
-    return BUILTIN_NONE;
+static int bi_echo(Shell *sh, Command *cmd) {
+    (void)sh;
+    int newline = 1;
+    int escapes = 0;
+    int i = 1;
+    for (; i < cmd->argc; i++) {
+        const char *a = cmd->argv[i];
+        if (a[0] != '-' || !a[1] || strspn(a + 1, "neE") != strlen(a + 1)) break;
+        for (a++; *a; a++) {
+            if (*a == 'n') newline = 0;
+            else if (*a == 'e') escapes = 1;
+            else escapes = 0;
+        }
+    }
+    for (int first = i; i < cmd->argc; i++) {
+        if (i > first) putchar(' ');
+        if (!escapes) fputs(cmd->argv[i], stdout);
+        else if (put_escaped(cmd->argv[i]) < 0) return 0;
+    }
+    if (newline) putchar('\n');
+    return 0;
+}
+
+static int printf_number(const char *arg, long long *out) {
+    char *end;
+    errno = 0;
+    if (arg[0] == '\'' || arg[0] == '"') {
+        *out = (unsigned char)arg[1];
+        return 0;
+    }
+    *out = strtoll(arg, &end, 0);
+    if (end == arg || *end || errno) {
+        fprintf(stderr, "myshell: printf: %s: invalid number\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
+static int bi_printf(Shell *sh, Command *cmd) {
+    (void)sh;
+    if (cmd->argc < 2) {
+        fprintf(stderr, "myshell: printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    const char *fmt = cmd->argv[1];
+    int arg = 2;
+    int rc = 0;
+    do {
+        int consumed = arg;
+        for (const char *p = fmt; *p; p++) {
+            if (*p == '\\') {
+                int n = put_escape(p + 1);
+                if (n < 0) return rc;
+                p += n;
+                continue;
+            }
+            if (*p != '%') {
+                putchar(*p);
+                continue;
+            }
+            if (p[1] == '%') {
+                putchar('%');
+                p++;
+                continue;
+            }
+
+            char spec[32];
+            size_t n = 0;
+            spec[n++] = *p++;
+            while (*p && strchr("-+ #0123456789.", *p) && n < sizeof(spec) - 4) spec[n++] = *p++;
+            if (!*p) break;
+
+            const char *a = arg < cmd->argc ? cmd->argv[arg++] : NULL;
+            long long v = 0;
+            switch (*p) {
+            case 's':
+                spec[n++] = 's';
+                spec[n] = '\0';
+                printf(spec, a ? a : "");
+                break;
+            case 'b':
+                if (a && put_escaped(a) < 0) return rc;
+                break;
+            case 'c':
+                if (a && a[0]) putchar(a[0]);
+                break;
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+                if (a && printf_number(a, &v) < 0) rc = 1;
+                spec[n++] = 'l';
+                spec[n++] = 'l';
+                spec[n++] = *p;
+                spec[n] = '\0';
+                if (*p == 'd' || *p == 'i') printf(spec, v);
+                else printf(spec, (unsigned long long)v);
+                break;
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': {
+                double d = a ? strtod(a, NULL) : 0.0;
+                spec[n++] = *p;
+                spec[n] = '\0';
+                printf(spec, d);
+                break;
+            }
+            default:
+                fprintf(stderr, "myshell: printf: %%%c: invalid directive\n", *p);
+                return 1;
+            }
+        }
+        if (arg == consumed) break;
+    } while (arg < cmd->argc);
+    return rc;
 }
 
+static int test_unary(const char *op, const char *s, int *result) {
+    struct stat st;
+    if (op[0] != '-' || !op[1] || op[2]) return -1;
+    switch (op[1]) {
+    case 'n': *result = s[0] != '\0'; return 0;
+    case 'z': *result = s[0] == '\0'; return 0;
+    case 'e': *result = stat(s, &st) == 0; return 0;
+    case 'f': *result = stat(s, &st) == 0 && S_ISREG(st.st_mode); return 0;
+    case 'd': *result = stat(s, &st) == 0 && S_ISDIR(st.st_mode); return 0;
+    case 'p': *result = stat(s, &st) == 0 && S_ISFIFO(st.st_mode); return 0;
+    case 's': *result = stat(s, &st) == 0 && st.st_size > 0; return 0;
+    case 'h':
+    case 'L': *result = lstat(s, &st) == 0 && S_ISLNK(st.st_mode); return 0;
+    case 'r': *result = access(s, R_OK) == 0; return 0;
+    case 'w': *result = access(s, W_OK) == 0; return 0;
+    case 'x': *result = access(s, X_OK) == 0; return 0;
+    case 't': *result = isatty(atoi(s)); return 0;
+    }
+    return -1;
+}
+
+static int test_binary(const char *a, const char *op, const char *b, int *result) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+        *result = strcmp(a, b) == 0;
+        return 0;
+    }
+    if (strcmp(op, "!=") == 0) {
+        *result = strcmp(a, b) != 0;
+        return 0;
+    }
+
+    static const char *ops[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+    int k = -1;
+    for (int i = 0; i < 6; i++) {
+        if (strcmp(op, ops[i]) == 0) k = i;
+    }
+    if (k < 0) return -1;
+
+    char *end;
+    long long x = strtoll(a, &end, 10);
+    if (end == a || *end) {
+        fprintf(stderr, "myshell: test: %s: integer expression expected\n", a);
+        return -2;
+    }
+    long long y = strtoll(b, &end, 10);
+    if (end == b || *end) {
+        fprintf(stderr, "myshell: test: %s: integer expression expected\n", b);
+        return -2;
+    }
+    switch (k) {
+    case 0: *result = x == y; break;
+    case 1: *result = x != y; break;
+    case 2: *result = x < y; break;
+    case 3: *result = x <= y; break;
+    case 4: *result = x > y; break;
+    default: *result = x >= y; break;
+    }
+    return 0;
+}
+
+/* POSIX test, decided by argument count; returns 1 for true, 0 for false
+ * and -1 after printing a syntax error. */
+static int test_eval(int argc, char **argv) {
+    int r = 0;
+    switch (argc) {
+    case 0:
+        return 0;
+    case 1:
+        return argv[0][0] != '\0';
+    case 2:
+        if (strcmp(argv[0], "!") == 0) return argv[1][0] == '\0';
+        if (test_unary(argv[0], argv[1], &r) == 0) return r;
+        fprintf(stderr, "myshell: test: %s: unary operator expected\n", argv[0]);
+        return -1;
+    case 3: {
+        int rc = test_binary(argv[0], argv[1], argv[2], &r);
+        if (rc == 0) return r;
+        if (rc == -2) return -1;
+        if (strcmp(argv[0], "!") == 0) {
+            r = test_eval(2, argv + 1);
+            return r < 0 ? r : !r;
+        }
+        fprintf(stderr, "myshell: test: %s: binary operator expected\n", argv[1]);
+        return -1;
+    }
+    case 4:
+        if (strcmp(argv[0], "!") == 0) {
+            r = test_eval(3, argv + 1);
+            return r < 0 ? r : !r;
+        }
+        break;
+    }
+    fprintf(stderr, "myshell: test: too many arguments\n");
+    return -1;
+}
+
+static int bi_test(Shell *sh, Command *cmd) {
+    (void)sh;
+    int argc = cmd->argc - 1;
+    if (strcmp(cmd->argv[0], "[") == 0) {
+        if (argc == 0 || strcmp(cmd->argv[argc], "]") != 0) {
+            fprintf(stderr, "myshell: [: missing ]\n");
+            return 2;
+        }
+        argc--;
+    }
+    int r = test_eval(argc, cmd->argv + 1);
+    if (r < 0) return 2;
+    return r ? 0 : 1;
+}
+
+static int sleep_arg(const char *s, double *out) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || v < 0) return -1;
+    switch (*end) {
+    case '\0': case 's': break;
+    case 'm': v *= 60; break;
+    case 'h': v *= 3600; break;
+    case 'd': v *= 86400; break;
+    default: return -1;
+    }
+    if (*end && end[1]) return -1;
+    *out += v;
+    return 0;
+}
+
+static int bi_sleep(Shell *sh, Command *cmd) {
+    (void)sh;
+    double secs = 0;
+    if (cmd->argc < 2) {
+        fprintf(stderr, "myshell: sleep: missing operand\n");
+        return 1;
+    }
+    for (int i = 1; i < cmd->argc; i++) {
+        if (sleep_arg(cmd->argv[i], &secs) < 0) {
+            fprintf(stderr, "myshell: sleep: invalid time interval '%s'\n", cmd->argv[i]);
+            return 1;
+        }
+    }
+
+    struct timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (time_t)secs;
+    deadline.tv_nsec += (long)((secs - (double)(time_t)secs) * 1e9);
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    /* The shell ignores SIGINT; blocking it queues it so Ctrl-C still ends
+     * an in-process sleep. */
+    sigset_t intr, old;
+    sigemptyset(&intr);
+    sigaddset(&intr, SIGINT);
+    sigprocmask(SIG_BLOCK, &intr, &old);
+
+    int rc = 0;
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        struct timespec left = { deadline.tv_sec - now.tv_sec, deadline.tv_nsec - now.tv_nsec };
+        if (left.tv_nsec < 0) {
+            left.tv_sec--;
+            left.tv_nsec += 1000000000L;
+        }
+        if (left.tv_sec < 0) break;
+        if (sigtimedwait(&intr, NULL, &left) == SIGINT) {
+            fputc('\n', stderr);
+            rc = 128 + SIGINT;
+            break;
+        }
+        if (errno == EAGAIN) break;
+    }
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return rc;
+}
+
+/* After a failed copy: 128+SIGINT when Ctrl-C broke it off, otherwise 1.
+ * A reader that went away (EPIPE) is not worth a message. */
+static int copy_failed(const char *who, const char *name) {
+    if (errno == EINTR) {
+        fputc('\n', stderr);
+        return 128 + SIGINT;
+    }
+    if (errno != EPIPE) fprintf(stderr, "myshell: %s: %s: %s\n", who, name, strerror(errno));
+    return 1;
+}
+
+static int bi_cat(Shell *sh, Command *cmd) {
+    (void)sh;
+    if (cmd->argc == 1) return fastcopy_fd(STDIN_FILENO, STDOUT_FILENO) < 0 ? copy_failed("cat", "-") : 0;
+
+    int rc = 0;
+    for (int i = 1; i < cmd->argc; i++) {
+        const char *name = cmd->argv[i];
+        int fd = strcmp(name, "-") == 0 ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "myshell: cat: %s: %s\n", name, strerror(errno));
+            rc = 1;
+            continue;
+        }
+        int stop = 0;
+        if (fastcopy_fd(fd, STDOUT_FILENO) < 0) {
+            stop = errno == EPIPE || errno == EINTR;
+            rc = copy_failed("cat", name);
+        }
+        if (fd != STDIN_FILENO) close(fd);
+        if (stop) break;
+    }
+    return rc;
+}
+
+static int tee_fallback(int *fds, int nfds) {
+    char buf[65536];
+    int rc = 0;
+    for (;;) {
+        if (signals_interrupted()) {
+            errno = EINTR;
+            return copy_failed("tee", "-");
+        }
+        ssize_t r = read(STDIN_FILENO, buf, sizeof(buf));
+        if (r < 0) return copy_failed("tee", "-");
+        if (r == 0) return rc;
+        for (int i = 0; i < nfds; i++) {
+            if (fds[i] < 0) continue;
+            for (ssize_t off = 0; off < r;) {
+                ssize_t w = write(fds[i], buf + off, (size_t)(r - off));
+                if (w < 0) {
+                    if (errno == EINTR || (i == 0 && errno == EPIPE)) return copy_failed("tee", "-");
+                    fds[i] = -1;
+                    rc = 1;
+                    break;
+                }
+                off += w;
+            }
+        }
+    }
+}
+
+static int bi_tee(Shell *sh, Command *cmd) {
+    (void)sh;
+    /* builtin_for only lets -a through, in any position. */
+    int append = 0;
+    int nfds = 1;
+    for (int i = 1; i < cmd->argc; i++) {
+        if (cmd->argv[i][0] == '-' && cmd->argv[i][1]) append = 1;
+        else nfds++;
+    }
+
+    int *fds = (int *)malloc(sizeof(int) * (size_t)nfds);
+    if (!fds) {
+        fprintf(stderr, "myshell: tee: out of memory\n");
+        return 1;
+    }
+    fds[0] = STDOUT_FILENO;
+
+    int rc = 0;
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+    for (int i = 1, k = 1; i < cmd->argc; i++) {
+        if (cmd->argv[i][0] == '-' && cmd->argv[i][1]) continue;
+        fds[k] = open(cmd->argv[i], flags, 0644);
+        if (fds[k] < 0) {
+            fprintf(stderr, "myshell: tee: %s: %s\n", cmd->argv[i], strerror(errno));
+            rc = 1;
+        }
+        k++;
+    }
+
+    struct stat st;
+    if (nfds == 2 && fds[1] >= 0 && fstat(STDIN_FILENO, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        if (fastcopy_tee(STDIN_FILENO, STDOUT_FILENO, fds[1]) < 0) rc = copy_failed("tee", "-");
+    } else {
+        int status = tee_fallback(fds, nfds);
+        if (status) rc = status;
+    }
+
+    for (int k = 1; k < nfds; k++) {
+        if (fds[k] >= 0) close(fds[k]);
+    }
+    free(fds);
+    return rc;
+}
+
+static int cp_one(const char *src, const char *dst, int dst_is_dir) {
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        fprintf(stderr, "myshell: cp: %s: %s\n", src, strerror(errno));
+        return 1;
+    }
+    struct stat st;
+    if (fstat(in, &st) < 0) {
+        fprintf(stderr, "myshell: cp: %s: %s\n", src, strerror(errno));
+        close(in);
+        return 1;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "myshell: cp: %s: is a directory\n", src);
+        close(in);
+        return 1;
+    }
+
+    char path[PATH_MAX];
+    if (dst_is_dir) {
+        const char *base = strrchr(src, '/');
+        base = base ? base + 1 : src;
+        if (snprintf(path, sizeof(path), "%s/%s", dst, base) >= (int)sizeof(path)) {
+            fprintf(stderr, "myshell: cp: %s: name too long\n", dst);
+            close(in);
+            return 1;
+        }
+        dst = path;
+    }
+
+    /* Truncating only after the check keeps cp f f from emptying f. */
+    int out = open(dst, O_WRONLY | O_CREAT | O_CLOEXEC, st.st_mode & 0777);
+    struct stat ost;
+    if (out < 0 || fstat(out, &ost) < 0) {
+        fprintf(stderr, "myshell: cp: %s: %s\n", dst, strerror(errno));
+        if (out >= 0) close(out);
+        close(in);
+        return 1;
+    }
+    if (ost.st_dev == st.st_dev && ost.st_ino == st.st_ino) {
+        fprintf(stderr, "myshell: cp: %s and %s are the same file\n", src, dst);
+        close(out);
+        close(in);
+        return 1;
+    }
+    int rc = 0;
+    if (S_ISREG(ost.st_mode) && ftruncate(out, 0) < 0) {
+        fprintf(stderr, "myshell: cp: %s: %s\n", dst, strerror(errno));
+        rc = 1;
+    } else if (fastcopy_fd(in, out) < 0) {
+        rc = copy_failed("cp", dst);
+    }
+    close(in);
+    close(out);
+    return rc;
+}
+
+static int bi_cp(Shell *sh, Command *cmd) {
+    (void)sh;
+    if (cmd->argc < 3) {
+        fprintf(stderr, "myshell: cp: usage: cp source... dest\n");
+        return 1;
+    }
+    const char *dst = cmd->argv[cmd->argc - 1];
+    struct stat st;
+    int is_dir = stat(dst, &st) == 0 && S_ISDIR(st.st_mode);
+    if (cmd->argc > 3 && !is_dir) {
+        fprintf(stderr, "myshell: cp: %s: not a directory\n", dst);
+        return 1;
+    }
+
+    int rc = 0;
+    for (int i = 1; i < cmd->argc - 1; i++) {
+        int status = cp_one(cmd->argv[i], dst, is_dir);
+        if (status == 128 + SIGINT) return status;
+        rc |= status;
+    }
+    return rc;
+}
+
+static const Builtin builtins[] = {
+    { "exit", bi_exit, BUILTIN_QUITS, NULL },
+    { "quit", bi_exit, BUILTIN_QUITS, NULL },
+    { "cd", bi_cd, 0, NULL },
+    { "jobs", bi_jobs, 0, NULL },
+    { "wait", bi_wait, 0, NULL },
+    { "fg", bi_fg, 0, NULL },
+    { "bg", bi_bg, 0, NULL },
+    { "hash", bi_hash, 0, NULL },
+    { "set", bi_set, 0, NULL },
+    { "ulimit", bi_ulimit, 0, NULL },
+    { "affinity", bi_affinity, 0, NULL },
+    { "export", bi_export, 0, NULL },
+    { "unset", bi_unset, 0, NULL },
+    { "coproc", bi_coproc, 0, NULL },
+    { "cowrite", bi_cowrite, 0, NULL },
+    { "coread", bi_coread, 0, NULL },
+    { "coclose", bi_coclose, 0, NULL },
+    { "history", bi_history, BUILTIN_STAGE | BUILTIN_BLOCKS, NULL },
+    { "true", bi_true, BUILTIN_STAGE, NULL },
+    { "false", bi_false, BUILTIN_STAGE, NULL },
+    { "pwd", bi_pwd, BUILTIN_STAGE, NULL },
+    { "echo", bi_echo, BUILTIN_STAGE, NULL },
+    { "printf", bi_printf, BUILTIN_STAGE, NULL },
+    { "test", bi_test, BUILTIN_STAGE, NULL },
+    { "[", bi_test, BUILTIN_STAGE, NULL },
+    { "sleep", bi_sleep, BUILTIN_STAGE | BUILTIN_BLOCKS, NULL },
+    { "cat", bi_cat, BUILTIN_STAGE | BUILTIN_BLOCKS, "" },
+    { "tee", bi_tee, BUILTIN_STAGE | BUILTIN_BLOCKS, "a" },
+    { "cp", bi_cp, BUILTIN_STAGE | BUILTIN_BLOCKS, "" },
+};
+
+#define NBUILTINS (sizeof(builtins) / sizeof(builtins[0]))
+#define INDEX_SIZE 64
+
+static const Builtin *g_index[INDEX_SIZE];
+
+const char *builtin_name(size_t i) {
+    return i < NBUILTINS ? builtins[i].name : NULL;
+}
+
+static size_t name_hash(const char *s) {
+    size_t h = 2166136261u;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
+    }
+    return h & (INDEX_SIZE - 1);
+}
+
+const Builtin *builtin_find(const char *name) {
+    if (!g_index[name_hash(builtins[0].name)]) {
+        for (size_t i = 0; i < NBUILTINS; i++) {
+            size_t k = name_hash(builtins[i].name);
+            while (g_index[k]) k = (k + 1) & (INDEX_SIZE - 1);
+            g_index[k] = &builtins[i];
+        }
+    }
+
+    for (size_t k = name_hash(name); g_index[k]; k = (k + 1) & (INDEX_SIZE - 1)) {
+        if (strcmp(g_index[k]->name, name) == 0) return g_index[k];
+    }
+    return NULL;
+}
+
+/* builtin_find, except that a stand-in for a PATH command given an option
+ * it does not implement is left to the real command. */
+const Builtin *builtin_for(Command *cmd) {
+    const Builtin *b = builtin_find(cmd->argv[0]);
+    if (!b || !b->opts) return b;
+    for (int i = 1; i < cmd->argc; i++) {
+        const char *w = cmd->argv[i];
+        if (w[0] != '-' || w[1] == '\0') continue;
+        for (w++; *w; w++) {
+            if (!strchr(b->opts, *w)) return NULL;
+        }
+    }
+    return b;
+}
+
+static int swap_fd(int fd, int target, int *saved) {
+    *saved = fcntl(target, F_DUPFD_CLOEXEC, 10);
+    if (*saved < 0 || dup2(fd, target) < 0) {
+        perror("dup2");
+        if (*saved >= 0) close(*saved);
+        *saved = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static int swap_file(const char *path, int flags, int target, int *saved) {
+    int fd = open(path, flags | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    int rc = swap_fd(fd, target, saved);
+    close(fd);
+    return rc;
+}
+
+static void restore_fd(int saved, int target) {
+    if (saved < 0) return;
+    dup2(saved, target);
+    close(saved);
+}
+
+typedef struct SavedFd {
+    int fd;
+    int copy;
+} SavedFd;
+
+/* Applies cmd->redirs to the shell's own fds. Each fd is saved the first
+ * time it is touched; a copy of -1 means it was closed before. */
+static int swap_redirs(Command *cmd, SavedFd *saved, int *nsaved) {
+    for (int i = 0; i < cmd->nredirs; i++) {
+        const Redir *r = &cmd->redirs[i];
+        int seen = 0;
+        for (int k = 0; k < *nsaved && !seen; k++) seen = saved[k].fd == r->fd;
+        if (!seen) {
+            saved[*nsaved].fd = r->fd;
+            saved[*nsaved].copy = fcntl(r->fd, F_DUPFD_CLOEXEC, 10);
+            (*nsaved)++;
+        }
+
+        if (r->kind == REDIR_DUP) {
+            if (r->dup_fd < 0) {
+                close(r->fd);
+            } else if (r->dup_fd != r->fd && dup2(r->dup_fd, r->fd) < 0) {
+                fprintf(stderr, "myshell: %d: %s\n", r->dup_fd, strerror(errno));
+                return -1;
+            }
+            continue;
+        }
+        int fd = execute_redir_open(r);
+        if (fd < 0) {
+            perror(execute_redir_name(r));
+            return -1;
+        }
+        if (fd != r->fd) {
+            dup2(fd, r->fd);
+            close(fd);
+        }
+    }
+    return 0;
+}
+
+static void restore_redirs(SavedFd *saved, int n) {
+    while (n-- > 0) {
+        if (saved[n].copy < 0) close(saved[n].fd);
+        else restore_fd(saved[n].copy, saved[n].fd);
+    }
+}
+
+int builtin_run(Shell *sh, const Builtin *b, Command *cmd, int in_fd, int out_fd) {
+    fflush(stdout);
+    int saved_in = -1, saved_out = -1;
+    SavedFd *saved = NULL;
+    int nsaved = 0;
+    int status = 1;
+
+    struct sigaction ign, old_pipe;
+    if (out_fd >= 0) {
+        memset(&ign, 0, sizeof(ign));
+        ign.sa_handler = SIG_IGN;
+        sigaction(SIGPIPE, &ign, &old_pipe);
+    }
+
+    if (in_fd >= 0 && swap_fd(in_fd, STDIN_FILENO, &saved_in) < 0) goto done;
+    if (out_fd >= 0 && swap_fd(out_fd, STDOUT_FILENO, &saved_out) < 0) goto done;
+    if (cmd->in_file) {
+        restore_fd(saved_in, STDIN_FILENO);
+        if (swap_file(cmd->in_file, O_RDONLY, STDIN_FILENO, &saved_in) < 0) goto done;
+    }
+    if (cmd->out_file) {
+        int flags = O_WRONLY | O_CREAT | (cmd->out_append ? O_APPEND : O_TRUNC);
+        restore_fd(saved_out, STDOUT_FILENO);
+        if (swap_file(cmd->out_file, flags, STDOUT_FILENO, &saved_out) < 0) goto done;
+    }
+    if (cmd->nredirs) {
+        saved = (SavedFd *)malloc(sizeof(SavedFd) * (size_t)cmd->nredirs);
+        if (!saved || swap_redirs(cmd, saved, &nsaved) < 0) goto done;
+    }
+
+    status = b->run(sh, cmd);
+    fflush(stdout);
+
+done:
+    restore_redirs(saved, nsaved);
+    free(saved);
+    restore_fd(saved_out, STDOUT_FILENO);
+    restore_fd(saved_in, STDIN_FILENO);
+    if (out_fd >= 0) sigaction(SIGPIPE, &old_pipe, NULL);
+    return status;
+}
+
+int builtin_execute(Shell *sh, Command *cmd) {
+    if (!cmd || cmd->argc == 0 || !cmd->argv || !cmd->argv[0]) return BUILTIN_NONE;
+
+    const Builtin *b = builtin_for(cmd);
+    if (!b) return BUILTIN_NONE;
+    if (b->flags & BUILTIN_QUITS) {
+        int status = b->run(sh, cmd);
+        sh->status = status < 0 ? 1 : status;
+        return status < 0 ? BUILTIN_HANDLED : BUILTIN_EXIT;
+    }
+    /* A stage builtin runs in a child like any command when it must get
+     * launch attributes, the same rule run_pipe uses for inlining. */
+    if ((b->flags & BUILTIN_STAGE) && (cmd->background || execute_attrs())) return BUILTIN_NONE;
+
+    Usage usage;
+    struct rusage before;
+    usage_begin(&usage);
+    getrusage(RUSAGE_SELF, &before);
+
+    if (b->flags & BUILTIN_BLOCKS) signals_break_int(1);
+    int status = builtin_run(sh, b, cmd, -1, -1);
+    if (b->flags & BUILTIN_BLOCKS) signals_break_int(0);
+    usage_end_self(&usage, &before);
+    sh->status = status & 0xff;
+
+    if (b->flags & BUILTIN_STAGE) {
+        int wstatus = (status & 0xff) << 8;
+        LogRecord rec = { getpid(), cmd->rawline, &wstatus, 1, 0, &usage, NULL };
+        logger_write(sh->log_fd, &rec);
+    }
+    if (cmd->timed) usage_print(stderr, &usage);
+    return BUILTIN_HANDLED;
+}
@@ -1,54 +1,265 @@
+#define _GNU_SOURCE
 #include "execute.h"
+#include "builtin.h"
 #include "logger.h"
+#include "pathcache.h"
+#include "usage.h"
+#include "signals.h"
+#include "vars.h"
+#include "arena.h"
+#include "attrs.h"
+#include "size.h"
+#include <time.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <spawn.h>
+#include <sys/mman.h>
+
+static int g_launch = LAUNCH_SPAWN;
+
+static const char *launch_names[] = { "fork", "spawn" };
+
+int execute_set_launch(const char *name) {
+    for (int i = 0; i < (int)(sizeof(launch_names) / sizeof(launch_names[0])); i++) {
+        if (strcmp(name, launch_names[i]) == 0) {
+            g_launch = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *execute_launch_name(void) {
+    return launch_names[g_launch];
+}
+
+static int g_pipesize = 0;
+
+static long pipe_max_size(void) {
+    long max = 1048576;
+    FILE *f = fopen("/proc/sys/fs/pipe-max-size", "r");
+    if (f) {
+        if (fscanf(f, "%ld", &max) != 1) max = 1048576;
+        fclose(f);
+    }
+    return max;
+}
+
+int execute_set_pipesize(const char *arg, int *capped) {
+    long long req = size_parse(arg);
+    if (req < 0) {
+        errno = 0; /* reported as an invalid size, not a system error */
+        return -1;
+    }
+
+    *capped = 0;
+    if (req == 0) {
+        g_pipesize = 0;
+        return 0;
+    }
+    long max = pipe_max_size();
+    if (req > max) {
+        req = max;
+        *capped = 1;
+    }
+
+    int probe[2];
+    if (pipe2(probe, O_CLOEXEC) < 0) return -1;
+    int granted = fcntl(probe[1], F_SETPIPE_SZ, (int)req);
+    close(probe[0]);
+    close(probe[1]);
+    if (granted < 0) return -1;
+    g_pipesize = granted;
+    return granted;
+}
+
+int execute_pipesize(void) {
+    return g_pipesize;
+}
+
+/* What the command being run launches with: a `with` prefix on top of the
+ * session defaults, or NULL for just the defaults. */
+static const Attrs *g_attrs = NULL;
+static char g_attrs_desc[256];
+
+static const Attrs *launch_attrs(void) {
+    return g_attrs ? g_attrs : attrs_session();
+}
+
+/* The attributes launches currently get as NAME=VALUE words, or NULL. */
+const char *execute_attrs(void) {
+    const Attrs *a = launch_attrs();
+    if (!attrs_any(a)) return NULL;
+    attrs_describe(a, g_attrs_desc, sizeof(g_attrs_desc));
+    return g_attrs_desc;
+}
+
+/* with NAME=VALUE... [--] cmd: the rest of the pipeline runs with these
+ * attributes on top of the current ones. cmd may be shared through the parse
+ * cache, so with_enter leaves it alone and runs a copy without the prefix;
+ * with_leave restores the attributes. */
+typedef struct With {
+    Attrs attrs;
+    const Attrs *saved;
+    Command cmd;
+} With;
+
+static int is_with(const Command *cmd) {
+    return cmd->argc > 0 && strcmp(cmd->argv[0], "with") == 0;
+}
+
+static int with_enter(const Command *cmd, With *w) {
+    w->attrs = *launch_attrs();
+    int i = 1;
+    for (; i < cmd->argc && strcmp(cmd->argv[i], "--") != 0 && strchr(cmd->argv[i], '='); i++) {
+        if (attrs_set(&w->attrs, "with", cmd->argv[i]) < 0) return -1;
+    }
+    if (i < cmd->argc && strcmp(cmd->argv[i], "--") == 0) i++;
+    if (i == cmd->argc) {
+        fprintf(stderr, "myshell: with: missing command\n");
+        return -1;
+    }
+
+    w->cmd = *cmd;
+    w->cmd.argv += i;
+    w->cmd.argc -= i;
+    w->saved = g_attrs;
+    g_attrs = &w->attrs;
+    return 0;
+}
+
+static void with_leave(With *w) {
+    g_attrs = w->saved;
+}
+
+typedef struct Launch {
+    int in_fd;
+    int out_fd;
+    int err_fd;
+    int first;
+    int last;
+    pid_t pgid;
+    const int *pipes;
+    int npipes;
+} Launch;
+
+static const int child_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU };
+
+static void child_default_signals(sigset_t *set) {
+    sigemptyset(set);
+    for (size_t i = 0; i < sizeof(child_signals) / sizeof(child_signals[0]); i++) {
+        sigaddset(set, child_signals[i]);
+    }
+}
 
 static void child_reset_signals(void) {
-    signal(SIGINT, SIG_DFL);
+    for (size_t i = 0; i < sizeof(child_signals) / sizeof(child_signals[0]); i++) {
+        signal(child_signals[i], SIG_DFL);
+    }
     sigset_t empty;
     sigemptyset(&empty);
     sigprocmask(SIG_SETMASK, &empty, NULL);
 }
 
-static void apply_redirs_simple(Command *cmd) {
-    if (cmd->in_file) {
-        int fd = open(cmd->in_file, O_RDONLY);
-        if (fd < 0) {
-            perror(cmd->in_file);
-            _exit(1);
-        }
-        if (dup2(fd, STDIN_FILENO) < 0) {
-            perror("dup2");
-            close(fd);
-            _exit(1);
-        }
-        close(fd);
+static int redir_check(Command *cmd, int first, int last) {
+    if (cmd->in_file && !first) {
+        fprintf(stderr, "myshell: input redirection only supported on first stage of pipe\n");
+        return -1;
+    }
+    if (cmd->out_file && !last) {
+        fprintf(stderr, "myshell: output redirection only supported on last stage of pipe\n");
+        return -1;
     }
+    return 0;
+}
 
-    if (cmd->out_file) {
-        int flags = O_WRONLY | O_CREAT;
-        if (cmd->out_append) flags |= O_APPEND;
-        else flags |= O_TRUNC;
+static int out_flags(Command *cmd) {
+    int flags = O_WRONLY | O_CREAT;
+    if (cmd->out_append) flags |= O_APPEND;
+    else flags |= O_TRUNC;
+    return flags;
+}
 
-        int fd = open(cmd->out_file, flags, 0644);
+/* Here-document text reaches the command through a sealed memfd, so
+ * nothing touches the disk and no process has to feed a pipe. */
+static int data_fd(const char *data) {
+    int fd = memfd_create("myshell-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) return -1;
+
+    size_t len = strlen(data);
+    size_t off = 0;
+    while (off < len) {
+        ssize_t w = write(fd, data + off, len - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) goto fail;
+        off += (size_t)w;
+    }
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) goto fail;
+    if (lseek(fd, 0, SEEK_SET) < 0) goto fail;
+    return fd;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+static int redir_flags(const Redir *r) {
+    if (r->kind == REDIR_OUT) return O_WRONLY | O_CREAT | O_TRUNC;
+    if (r->kind == REDIR_APPEND) return O_WRONLY | O_CREAT | O_APPEND;
+    return O_RDONLY;
+}
+
+/* Opens what r reads from or writes to, close-on-exec. Not for REDIR_DUP. */
+int execute_redir_open(const Redir *r) {
+    if (r->kind == REDIR_DATA) return data_fd(r->target);
+    return open(r->target, redir_flags(r) | O_CLOEXEC, 0644);
+}
+
+const char *execute_redir_name(const Redir *r) {
+    return r->kind == REDIR_DATA ? "here-document" : r->target;
+}
+
+static void apply_redir_list(Command *cmd) {
+    for (int i = 0; i < cmd->nredirs; i++) {
+        const Redir *r = &cmd->redirs[i];
+        if (r->kind == REDIR_DUP) {
+            if (r->dup_fd < 0) {
+                close(r->fd);
+            } else if (r->dup_fd != r->fd && dup2(r->dup_fd, r->fd) < 0) {
+                fprintf(stderr, "myshell: %d: %s\n", r->dup_fd, strerror(errno));
+                _exit(1);
+            }
+            continue;
+        }
+
+        int fd = execute_redir_open(r);
         if (fd < 0) {
-            perror(cmd->out_file);
+            perror(execute_redir_name(r));
             _exit(1);
         }
-        if (dup2(fd, STDOUT_FILENO) < 0) {
-            perror("dup2");
+        if (fd == r->fd) {
+            fcntl(fd, F_SETFD, 0);
+        } else {
+            if (dup2(fd, r->fd) < 0) {
+                perror("dup2");
+                _exit(1);
+            }
             close(fd);
-            _exit(1);
         }
-        close(fd);
     }
 }
 
-static void apply_redirs_left_pipe(Command *cmd) {
+static void apply_redirs(Command *cmd, int first, int last) {
+    if (redir_check(cmd, first, last) < 0) _exit(2);
+    apply_redir_list(cmd);
+
     if (cmd->in_file) {
         int fd = open(cmd->in_file, O_RDONLY);
         if (fd < 0) {
@@ -62,23 +273,9 @@ static void apply_redirs_left_pipe(Command *cmd) {
         }
         close(fd);
     }
-    if (cmd->out_file) {
-        fprintf(stderr, "myshell: output redirection not supported on left side of pipe\n");
-        _exit(2);
-    }
-}
 
-static void apply_redirs_right_pipe(Command *cmd) {
-    if (cmd->in_file) {
-        fprintf(stderr, "myshell: input redirection not supported on right side of pipe\n");
-        _exit(2);
-    }
     if (cmd->out_file) {
-        int flags = O_WRONLY | O_CREAT;
-        if (cmd->out_append) flags |= O_APPEND;
-        else flags |= O_TRUNC;
-
-        int fd = open(cmd->out_file, flags, 0644);
+        int fd = open(cmd->out_file, out_flags(cmd), 0644);
         if (fd < 0) {
             perror(cmd->out_file);
             _exit(1);
@@ -92,139 +289,699 @@ static void apply_redirs_right_pipe(Command *cmd) {
     }
 }
 
-static void block_sigchld(sigset_t *oldmask) {
-    sigset_t set;
-    sigemptyset(&set);
-    sigaddset(&set, SIGCHLD);
-    sigprocmask(SIG_BLOCK, &set, oldmask);
+static void child_setup(Command *cmd, const Launch *l) {
+    if (l->pgid >= 0) setpgid(0, l->pgid);
+    child_reset_signals();
+    if (l->in_fd >= 0 && dup2(l->in_fd, STDIN_FILENO) < 0) {
+        perror("dup2");
+        _exit(1);
+    }
+    if (l->out_fd >= 0 && dup2(l->out_fd, STDOUT_FILENO) < 0) {
+        perror("dup2");
+        _exit(1);
+    }
+    if (l->err_fd >= 0 && dup2(l->err_fd, STDERR_FILENO) < 0) {
+        perror("dup2");
+        _exit(1);
+    }
+    apply_redirs(cmd, l->first, l->last);
+    if (attrs_apply(launch_attrs()) < 0) _exit(1);
 }
 
-static void restore_mask(sigset_t *oldmask) {
-    sigprocmask(SIG_SETMASK, oldmask, NULL);
-}
+static pid_t launch_fork(Command *cmd, const char *path, const Launch *l) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+
+    if (pid == 0) {
+        child_setup(cmd, l);
+        execve(path, cmd->argv, vars_envp());
+        int err = errno;
+        perror(cmd->argv[0]);
+        _exit(err == EACCES || err == ENOEXEC ? 126 : 127);
+    }
 
-static int run_simple(Command *cmd, int log_fd, Jobs *jobs) {
-    sigset_t oldmask;
-    block_sigchld(&oldmask);
+    if (l->pgid >= 0) setpgid(pid, l->pgid ? l->pgid : pid);
+    return pid;
+}
 
+static pid_t launch_builtin(Command *cmd, const Builtin *b, const Launch *l) {
+    fflush(stdout);
     pid_t pid = fork();
     if (pid < 0) {
-        restore_mask(&oldmask);
         perror("fork");
         return -1;
     }
 
     if (pid == 0) {
-        child_reset_signals();
-        apply_redirs_simple(cmd);
-        execvp(cmd->argv[0], cmd->argv);
-        perror(cmd->argv[0]);
-        _exit(127);
+        child_setup(cmd, l);
+        for (int i = 0; i < 2 * l->npipes; i++) close(l->pipes[i]);
+        int status = b->run(NULL, cmd);
+        fflush(stdout);
+        _exit(status);
+    }
+
+    if (l->pgid >= 0) setpgid(pid, l->pgid ? l->pgid : pid);
+    return pid;
+}
+
+static pid_t launch_spawn(Command *cmd, const char *path, const Launch *l) {
+    if (redir_check(cmd, l->first, l->last) < 0) return -1;
+
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawnattr_init(&attr);
+
+    if (l->in_fd >= 0) posix_spawn_file_actions_adddup2(&fa, l->in_fd, STDIN_FILENO);
+    if (l->out_fd >= 0) posix_spawn_file_actions_adddup2(&fa, l->out_fd, STDOUT_FILENO);
+    if (l->err_fd >= 0) posix_spawn_file_actions_adddup2(&fa, l->err_fd, STDERR_FILENO);
+    if (cmd->in_file) {
+        posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, cmd->in_file, O_RDONLY, 0);
+    }
+    if (cmd->out_file) {
+        posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, cmd->out_file, out_flags(cmd), 0644);
+    }
+
+    int *data = cmd->nredirs ? (int *)malloc(sizeof(int) * (size_t)cmd->nredirs) : NULL;
+    int ndata = 0;
+    for (int i = 0; i < cmd->nredirs; i++) {
+        const Redir *r = &cmd->redirs[i];
+        if (r->kind == REDIR_DUP && r->dup_fd < 0) {
+            posix_spawn_file_actions_addclose(&fa, r->fd);
+        } else if (r->kind == REDIR_DUP) {
+            posix_spawn_file_actions_adddup2(&fa, r->dup_fd, r->fd);
+        } else if (r->kind != REDIR_DATA) {
+            posix_spawn_file_actions_addopen(&fa, r->fd, r->target, redir_flags(r), 0644);
+        } else {
+            int fd = data ? data_fd(r->target) : -1;
+            if (fd < 0) {
+                perror(execute_redir_name(r));
+                for (int k = 0; k < ndata; k++) close(data[k]);
+                free(data);
+                posix_spawnattr_destroy(&attr);
+                posix_spawn_file_actions_destroy(&fa);
+                return -1;
+            }
+            data[ndata++] = fd;
+            posix_spawn_file_actions_adddup2(&fa, fd, r->fd);
+        }
+    }
+
+    sigset_t def, empty;
+    child_default_signals(&def);
+    sigemptyset(&empty);
+    posix_spawnattr_setsigdefault(&attr, &def);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    if (l->pgid >= 0) {
+        posix_spawnattr_setpgroup(&attr, l->pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    pid_t pid;
+    int err = posix_spawn(&pid, path, &fa, &attr, cmd->argv, vars_envp());
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    for (int k = 0; k < ndata; k++) close(data[k]);
+    free(data);
+
+    /* posix_spawn only reports an errno, after its child is gone. Redoing
+     * the launch through fork gives the same message, status and log record
+     * the fork backend would, naming the redirection or exec that failed. */
+    if (err != 0) return launch_fork(cmd, path, l);
+    return pid;
+}
+
+static const Builtin *stage_builtin(Command *cmd) {
+    const Builtin *b = builtin_for(cmd);
+    return (b && (b->flags & BUILTIN_STAGE)) ? b : NULL;
+}
+
+static pid_t launch_stage(Command *cmd, const char *path, const Launch *l) {
+    size_t mark = vars_push(cmd->assign, cmd->nassign);
+    pid_t pid;
+    if (!path) pid = launch_builtin(cmd, stage_builtin(cmd), l);
+    else if (g_launch == LAUNCH_SPAWN && !attrs_any(launch_attrs())) pid = launch_spawn(cmd, path, l);
+    else pid = launch_fork(cmd, path, l);
+    vars_pop(mark);
+    return pid;
+}
+
+/* Paths found under a PATH= prefix, kept until the next launch starts. */
+static Arena g_resolved;
+
+static const char *prefix_path(const Command *cmd) {
+    const char *path = NULL;
+    for (int i = 0; i < cmd->nassign; i++) {
+        if (strncmp(cmd->assign[i], "PATH=", 5) == 0) path = cmd->assign[i] + 5;
+    }
+    return path;
+}
+
+static const char *resolve(Command *cmd) {
+    if (stage_builtin(cmd)) return NULL;
+
+    /* PATH=dir cmd looks cmd up in dir, as exec would with that environment,
+     * without flushing the cache kept for the shell's own PATH. */
+    const char *prefix = prefix_path(cmd);
+    const char *path;
+    if (prefix) {
+        char *found = pathcache_search(cmd->argv[0], prefix);
+        path = found ? arena_strndup(&g_resolved, found, strlen(found)) : NULL;
+        free(found);
+    } else {
+        path = pathcache_lookup(cmd->argv[0]);
+    }
+    if (!path) fprintf(stderr, "myshell: %s: command not found\n", cmd->argv[0]);
+    return path;
+}
+
+int execute_exit_code(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status)) return 128 + WSTOPSIG(status);
+    return 1;
+}
+
+static void note_exit(Command *cmd, int status) {
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127) pathcache_forget(cmd->argv[0]);
+}
+
+static Job *announce_job(Shell *sh, const pid_t *pids, int n, const char *cmdline, const Usage *usage) {
+    Job *j = jobs_add(&sh->jobs, sh->job_control ? pids[0] : 0, pids, n, cmdline);
+    if (j) {
+        j->usage.start = usage->start;
+        jobs_set_attrs(j, execute_attrs());
+        printf("[%d] started pid %d\n", j->id, (int)pids[n - 1]);
+    } else {
+        fprintf(stderr, "myshell: cannot track job, pid %d\n", (int)pids[n - 1]);
+    }
+    return j;
+}
+
+static void take_terminal(Shell *sh, pid_t pgid) {
+    if (sh->job_control) tcsetpgrp(sh->tty_fd, pgid);
+}
+
+static int wait_stage(pid_t pid, Reaped *r) {
+    r->pid = pid;
+    if (wait4(pid, &r->status, WUNTRACED, &r->ru) < 0) return -1;
+    clock_gettime(CLOCK_MONOTONIC, &r->end);
+    return 0;
+}
+
+static pid_t leader(const pid_t *pids, int n) {
+    for (int i = 0; i < n; i++) {
+        if (pids[i]) return pids[i];
+    }
+    return 0;
+}
+
+/* A pid of 0 marks a stage that already ran inside the shell; its status is
+ * inline_status. */
+static int wait_foreground(Shell *sh, Command *cmd, const pid_t *pids, int n, int inline_status, Usage *usage) {
+    Reaped stack[8];
+    Reaped *reaped = (n <= 8) ? stack : (Reaped *)malloc(sizeof(Reaped) * (size_t)n);
+    int *statuses = (int *)malloc(sizeof(int) * (size_t)n);
+    if (!reaped || !statuses) {
+        if (reaped != stack) free(reaped);
+        free(statuses);
+        fprintf(stderr, "myshell: out of memory\n");
+        return -1;
+    }
+
+    pid_t pgid = leader(pids, n);
+    if (pgid) take_terminal(sh, pgid);
+
+    int rc = 0;
+    int stopped = 0;
+    for (int i = 0; i < n; i++) {
+        statuses[i] = -1;
+        if (!pids[i]) {
+            statuses[i] = inline_status;
+            continue;
+        }
+        if (stopped) continue;
+        if (wait_stage(pids[i], &reaped[i]) < 0) {
+            perror("wait4");
+            statuses[i] = 0;
+            rc = -1;
+        } else if (WIFSTOPPED(reaped[i].status)) {
+            stopped = 1;
+            sh->status = execute_exit_code(reaped[i].status);
+        } else {
+            statuses[i] = reaped[i].status;
+            usage_add(usage, &reaped[i].ru, &reaped[i].end);
+        }
+    }
+
+    take_terminal(sh, sh->pgid);
+
+    if (stopped) {
+        Job *j = jobs_add(&sh->jobs, sh->job_control ? pgid : 0, pids, n, cmd->rawline);
+        if (j) {
+            j->stopped = 1;
+            j->usage.start = usage->start;
+            jobs_set_attrs(j, execute_attrs());
+            for (int i = 0; i < n; i++) {
+                if (!pids[i]) {
+                    j->statuses[i] = inline_status;
+                    j->remaining--;
+                } else if (statuses[i] != -1) {
+                    jobs_reap(&sh->jobs, &reaped[i], sh->log_fd);
+                }
+            }
+            printf("\n[%d] Stopped %s\n", j->id, j->cmdline);
+        }
+    } else {
+        LogRecord rec = { pgid, cmd->rawline, statuses, n, 0, usage, execute_attrs() };
+        logger_write(sh->log_fd, &rec);
+        Command *stage = cmd;
+        for (int i = 0; i < n; i++, stage = stage->pipe_cmd) note_exit(stage, statuses[i]);
+        sh->status = execute_exit_code(statuses[n - 1]);
+        if (cmd->timed) usage_print(stderr, usage);
+    }
+
+    if (reaped != stack) free(reaped);
+    free(statuses);
+    return rc;
+}
+
+static int run_simple(Shell *sh, Command *cmd) {
+    arena_reset(&g_resolved);
+    const char *path = resolve(cmd);
+    if (!path && !stage_builtin(cmd)) {
+        logger_not_found(sh->log_fd, cmd->rawline, 0);
+        sh->status = 127;
+        return -1;
+    }
+
+    Usage usage;
+    usage_begin(&usage);
+
+    Launch l = { -1, -1, -1, 1, 1, sh->job_control ? 0 : -1, NULL, 0 };
+    pid_t pid = launch_stage(cmd, path, &l);
+    if (pid < 0) {
+        sh->status = 1;
+        return -1;
     }
 
     if (cmd->background) {
-        jobs_add(jobs, pid, cmd->rawline);
-        printf("[bg] started pid %d\n", (int)pid);
-        restore_mask(&oldmask);
+        announce_job(sh, &pid, 1, cmd->rawline, &usage);
+        sh->status = 0;
+        return 0;
+    }
+    return wait_foreground(sh, cmd, &pid, 1, 0, &usage);
+}
+
+int execute_stages(Command *cmd) {
+    int n = 0;
+    for (Command *c = cmd; c; c = c->has_pipe ? c->pipe_cmd : NULL) n++;
+    return n;
+}
+
+static void close_pipes(int *pfds, int npipes) {
+    for (int i = 0; i < 2 * npipes; i++) close(pfds[i]);
+}
+
+/* The one builtin stage that may run inside the shell, if any finishes
+ * promptly. Under job control only the first stage qualifies: the shell is
+ * not in the pipeline's group, so it must not need the terminal, which goes
+ * to the other stages while it runs. */
+static int inline_stage(Command *cmd, int n, int new_group) {
+    Command *stage = cmd;
+    for (int i = 0; i < n; i++, stage = stage->pipe_cmd) {
+        const Builtin *b = stage_builtin(stage);
+        if (b && !(b->flags & BUILTIN_BLOCKS)) return i;
+        if (new_group) break;
+    }
+    return -1;
+}
+
+static void close_pipes_except(int *pfds, int npipes, int keep_in, int keep_out) {
+    for (int i = 0; i < 2 * npipes; i++) {
+        if (pfds[i] != keep_in && pfds[i] != keep_out) close(pfds[i]);
+    }
+}
+
+/* Returns how many leading stages were started, with pids[i] set to 0 for a
+ * stage run in the shell (only when inline_status is given), or -1 when a
+ * command was not found. */
+static int start_stages(Shell *sh, Command *cmd, int n, int out_fd, int err_fd, int new_group, pid_t *pids,
+                        int *inline_status) {
+    int npipes = n - 1;
+    int inl = inline_status ? inline_stage(cmd, n, new_group) : -1;
+
+    int *pfds = (int *)malloc(sizeof(int) * 2 * (size_t)npipes);
+    const char **paths = (const char **)malloc(sizeof(char *) * (size_t)n);
+    if (!pfds || !paths) {
+        free(pfds);
+        free(paths);
+        fprintf(stderr, "myshell: out of memory\n");
         return 0;
     }
 
-    int status;
-    if (waitpid(pid, &status, 0) < 0) {
-        restore_mask(&oldmask);
-        perror("waitpid");
+    arena_reset(&g_resolved);
+    Command *stage = cmd;
+    int missing = 0;
+    for (int i = 0; i < n; i++, stage = stage->pipe_cmd) {
+        paths[i] = resolve(stage);
+        if (!paths[i] && !stage_builtin(stage)) missing = 1;
+    }
+    if (missing) {
+        free(pfds);
+        free(paths);
         return -1;
     }
 
-    logger_log(log_fd, pid, cmd->rawline, status);
-    restore_mask(&oldmask);
-    return 0;
+    for (int i = 0; i < npipes; i++) {
+        if (pipe2(pfds + 2 * i, O_CLOEXEC) < 0) {
+            perror("pipe");
+            close_pipes(pfds, i);
+            free(pfds);
+            free(paths);
+            return 0;
+        }
+        if (g_pipesize) fcntl(pfds[2 * i + 1], F_SETPIPE_SZ, g_pipesize);
+    }
+
+    int started = 0;
+    Command *inl_cmd = NULL;
+    stage = cmd;
+    for (int i = 0; i < n; i++, stage = stage->pipe_cmd) {
+        if (i == inl) {
+            inl_cmd = stage;
+            pids[started++] = 0;
+            continue;
+        }
+        Launch l;
+        l.in_fd = (i > 0) ? pfds[2 * (i - 1)] : -1;
+        l.out_fd = (i < npipes) ? pfds[2 * i + 1] : out_fd;
+        l.err_fd = err_fd;
+        l.first = (i == 0);
+        l.last = (i == n - 1);
+        pid_t pgid = leader(pids, started);
+        l.pgid = !new_group ? -1 : pgid;
+        l.pipes = pfds;
+        l.npipes = npipes;
+        pid_t pid = launch_stage(stage, paths[i], &l);
+        if (pid < 0) break;
+        pids[started++] = pid;
+    }
+
+    if (inl_cmd) {
+        int in = (inl > 0) ? pfds[2 * (inl - 1)] : -1;
+        int out = (inl < npipes) ? pfds[2 * inl + 1] : out_fd;
+        close_pipes_except(pfds, npipes, in, out);
+        /* Later stages that use the terminal must not stop while the shell
+         * fills the pipe they read. */
+        pid_t pgid = leader(pids, started);
+        if (new_group && pgid) take_terminal(sh, pgid);
+        if (redir_check(inl_cmd, inl == 0, inl == n - 1) < 0) {
+            *inline_status = 2 << 8;
+        } else {
+            int status = builtin_run(sh, stage_builtin(inl_cmd), inl_cmd, in, out);
+            *inline_status = (status & 0xff) << 8;
+        }
+        if (in >= 0) close(in);
+        if (out >= 0 && out != out_fd) close(out);
+    } else {
+        close_pipes(pfds, npipes);
+    }
+    free(pfds);
+    free(paths);
+    return started;
 }
 
-static int run_pipe(Command *cmd, int log_fd, Jobs *jobs) {
-    Command *left = cmd;
-    Command *right = cmd->pipe_cmd;
+/* Starts cmd as a background job with its stdin and stdout on pipes. The
+ * shell's ends, close-on-exec, go into co, which the job then owns. */
+Job *execute_coproc(Shell *sh, Command *cmd, Coproc *co) {
+    if (is_with(cmd)) {
+        With w;
+        if (with_enter(cmd, &w) < 0) return NULL;
+        Job *j = execute_coproc(sh, &w.cmd, co);
+        with_leave(&w);
+        return j;
+    }
+    arena_reset(&g_resolved);
+    const char *path = resolve(cmd);
+    if (!path && !stage_builtin(cmd)) return NULL;
 
-    int pfd[2];
-    if (pipe(pfd) < 0) {
+    Usage usage;
+    usage_begin(&usage);
+
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) < 0) {
+        perror("pipe");
+        return NULL;
+    }
+    if (pipe2(out, O_CLOEXEC) < 0) {
         perror("pipe");
+        close(in[0]);
+        close(in[1]);
+        return NULL;
+    }
+
+    int ours[2] = { in[1], out[0] };
+    Launch l = { in[0], out[1], -1, 1, 1, sh->job_control ? 0 : -1, ours, 1 };
+    pid_t pid = launch_stage(cmd, path, &l);
+    close(in[0]);
+    close(out[1]);
+    Job *j = pid < 0 ? NULL : announce_job(sh, &pid, 1, cmd->rawline, &usage);
+    if (!j) {
+        close(in[1]);
+        close(out[0]);
+        return NULL;
+    }
+    co->to_fd = in[1];
+    co->from_fd = out[0];
+    j->coproc = co;
+    return j;
+}
+
+/* *attrs gets what the stages were launched with (see execute_attrs), valid
+ * until the next call. */
+int execute_start(Command *cmd, int out_fd, int err_fd, pid_t *pids, const char **attrs) {
+    if (is_with(cmd)) {
+        With w;
+        if (with_enter(cmd, &w) < 0) return -1;
+        int started = execute_start(&w.cmd, out_fd, err_fd, pids, attrs);
+        with_leave(&w);
+        return started;
+    }
+    *attrs = execute_attrs();
+    return start_stages(NULL, cmd, execute_stages(cmd), out_fd, err_fd, 0, pids, NULL);
+}
+
+static int run_pipe(Shell *sh, Command *cmd) {
+    int n = execute_stages(cmd);
+    pid_t *pids = (pid_t *)malloc(sizeof(pid_t) * (size_t)n);
+    if (!pids) {
+        fprintf(stderr, "myshell: out of memory\n");
         return -1;
     }
 
-    sigset_t oldmask;
-    block_sigchld(&oldmask);
+    Usage usage;
+    usage_begin(&usage);
 
-    pid_t lp = fork();
-    if (lp < 0) {
-        restore_mask(&oldmask);
-        close(pfd[0]);
-        close(pfd[1]);
-        perror("fork");
+    int inline_status = 0;
+    /* A builtin run inside the shell would escape the launch attributes. */
+    int inl = !cmd->background && !attrs_any(launch_attrs());
+    int started = start_stages(sh, cmd, n, -1, -1, sh->job_control, pids, inl ? &inline_status : NULL);
+    if (started < 0) {
+        logger_not_found(sh->log_fd, cmd->rawline, 0);
+        sh->status = 127;
+        free(pids);
         return -1;
     }
+    int rc = (started == n) ? 0 : -1;
+    sh->status = rc == 0 ? 0 : 1;
 
-    if (lp == 0) {
-        child_reset_signals();
-        close(pfd[0]);
-        if (dup2(pfd[1], STDOUT_FILENO) < 0) {
-            perror("dup2");
-            _exit(1);
+    if (started > 0) {
+        if (rc == 0 && cmd->background) announce_job(sh, pids, started, cmd->rawline, &usage);
+        else if (wait_foreground(sh, cmd, pids, started, inline_status, &usage) < 0) rc = -1;
+    }
+
+    free(pids);
+    return rc;
+}
+
+int execute_foreground(Shell *sh, int id) {
+    jobs_handle_reaped(&sh->jobs, sh->reap_fd, sh->log_fd);
+
+    Job *j = jobs_get(&sh->jobs, id);
+    if (!j) return -1;
+
+    printf("%s\n", j->cmdline);
+    fflush(stdout);
+    take_terminal(sh, j->pgid ? j->pgid : sh->pgid);
+    jobs_signal(j, SIGCONT);
+    j->stopped = 0;
+
+    while ((j = jobs_get(&sh->jobs, id)) && !j->stopped) {
+        int i = 0;
+        while (j->statuses[i] != -1) i++;
+
+        Reaped r;
+        if (wait_stage(j->pids[i], &r) < 0) {
+            perror("wait4");
+            break;
         }
-        close(pfd[1]);
-        apply_redirs_left_pipe(left);
-        execvp(left->argv[0], left->argv);
-        perror(left->argv[0]);
-        _exit(127);
+        jobs_reap(&sh->jobs, &r, sh->log_fd);
     }
 
-    pid_t rp = fork();
-    if (rp < 0) {
-        restore_mask(&oldmask);
-        close(pfd[0]);
-        close(pfd[1]);
-        perror("fork");
-        return -1;
+    take_terminal(sh, sh->pgid);
+    if (j && j->stopped) printf("\n[%d] Stopped %s\n", j->id, j->cmdline);
+
+    return 0;
+}
+
+int execute_command(Shell *sh, Command *cmd) {
+    if (!cmd || cmd->argc == 0) return 0;
+    if (is_with(cmd)) {
+        With w;
+        if (with_enter(cmd, &w) < 0) {
+            sh->status = 2;
+            return -1;
+        }
+        int rc = execute_command(sh, &w.cmd);
+        with_leave(&w);
+        return rc;
     }
+    if (cmd->has_pipe) return run_pipe(sh, cmd);
+    return run_simple(sh, cmd);
+}
 
-    if (rp == 0) {
-        child_reset_signals();
-        close(pfd[1]);
-        if (dup2(pfd[0], STDIN_FILENO) < 0) {
-            perror("dup2");
-            _exit(1);
+
+static int g_loops = 0;
+
+static void loop_enter(void) {
+    if (g_loops++ == 0) signals_catch_int(1);
+}
+
+static void loop_leave(void) {
+    if (--g_loops == 0) signals_catch_int(0);
+}
+
+/* exit ends the whole line, and so does Ctrl-C in any command of it. */
+static int stop(Shell *sh, int rc) {
+    if (signals_interrupted()) sh->status = 128 + SIGINT;
+    return rc == BUILTIN_EXIT || sh->status == 128 + SIGINT;
+}
+
+static int run_node(Shell *sh, Command *cmd);
+
+static int run_while(Shell *sh, Command *cmd) {
+    int status = 0;
+    int rc = 0;
+    loop_enter();
+    for (;;) {
+        rc = run_node(sh, cmd->left);
+        if (stop(sh, rc)) break;
+        if ((sh->status == 0) != (cmd->kind == CMD_WHILE)) {
+            sh->status = status;
+            break;
         }
-        close(pfd[0]);
-        apply_redirs_right_pipe(right);
-        execvp(right->argv[0], right->argv);
-        perror(right->argv[0]);
-        _exit(127);
+        rc = run_node(sh, cmd->right);
+        status = sh->status;
+        if (stop(sh, rc)) break;
     }
+    loop_leave();
+    return rc;
+}
 
-    close(pfd[0]);
-    close(pfd[1]);
+static int run_for(Shell *sh, Command *cmd) {
+    Arena words;
+    arena_init(&words);
 
-    if (cmd->background) {
-        jobs_add(jobs, lp, cmd->rawline);
-        jobs_add(jobs, rp, cmd->rawline);
-        printf("[bg] started pid %d\n", (int)rp);
-        restore_mask(&oldmask);
-        return 0;
+    int rc = 0;
+    sh->status = 0;
+    loop_enter();
+    for (int i = 0; i < cmd->argc; i++) {
+        char *w = parse_expand_word(&words, cmd->argv[i], sh->status);
+        if (!w) {
+            fprintf(stderr, "myshell: out of memory\n");
+            break;
+        }
+        if (!*w && w != cmd->argv[i]) continue;
+        vars_set(cmd->var, w, VARS_KEEP);
+        rc = run_node(sh, cmd->right);
+        if (stop(sh, rc)) break;
     }
+    loop_leave();
+    arena_free(&words);
+    return rc;
+}
 
-    int st1 = 0, st2 = 0;
-    waitpid(lp, &st1, 0);
-    waitpid(rp, &st2, 0);
+static Arena g_scratch;
 
-    logger_log(log_fd, lp, cmd->rawline, st1);
-    logger_log(log_fd, rp, cmd->rawline, st2);
+static int run_pipeline(Shell *sh, Command *cmd) {
+    if (cmd->argc == 0) {
+        for (int i = 0; i < cmd->nassign; i++) vars_assign(cmd->assign[i], VARS_KEEP);
+        sh->status = 0;
+        return 0;
+    }
+    for (Command *c = cmd->pipe_cmd; cmd->has_pipe && c; c = c->has_pipe ? c->pipe_cmd : NULL) {
+        if (c->argc == 0) {
+            fprintf(stderr, "myshell: empty command in pipeline\n");
+            sh->status = 1;
+            return 0;
+        }
+    }
 
-    restore_mask(&oldmask);
-    return 0;
+    int b = BUILTIN_NONE;
+    if (!cmd->has_pipe) {
+        size_t mark = vars_push(cmd->assign, cmd->nassign);
+        b = builtin_execute(sh, cmd);
+        vars_pop(mark);
+    }
+    if (b == BUILTIN_NONE) execute_command(sh, cmd);
+    return b == BUILTIN_EXIT ? BUILTIN_EXIT : 0;
 }
 
-int execute_command(Command *cmd, int log_fd, Jobs *jobs) {
-    if (!cmd || cmd->argc == 0) return 0;
-    if (cmd->has_pipe) return run_pipe(cmd, log_fd, jobs);
-    return run_simple(cmd, log_fd, jobs);
+static int run_node(Shell *sh, Command *cmd) {
+    int rc;
+    switch (cmd->kind) {
+    case CMD_SEQ:
+        rc = run_node(sh, cmd->left);
+        return stop(sh, rc) ? rc : run_node(sh, cmd->right);
+    case CMD_AND:
+    case CMD_OR:
+        rc = run_node(sh, cmd->left);
+        if (stop(sh, rc) || (sh->status == 0) != (cmd->kind == CMD_AND)) return rc;
+        return run_node(sh, cmd->right);
+    case CMD_IF:
+        rc = run_node(sh, cmd->left);
+        if (stop(sh, rc)) return rc;
+        if (sh->status == 0) return run_node(sh, cmd->right);
+        if (cmd->alt) return run_node(sh, cmd->alt);
+        sh->status = 0;
+        return 0;
+    case CMD_WHILE:
+    case CMD_UNTIL:
+        return run_while(sh, cmd);
+    case CMD_FOR:
+        return run_for(sh, cmd);
+    }
+
+    Command *run = parse_expand(&g_scratch, cmd, sh->status);
+    if (!run) {
+        fprintf(stderr, "myshell: out of memory\n");
+        sh->status = 1;
+        return 0;
+    }
+    rc = run_pipeline(sh, run);
+    if (run != cmd) arena_reset(&g_scratch);
+    return rc;
 }
 
+/* Runs a whole parsed line, walking lists, conditionals and loops. Returns
+ * BUILTIN_EXIT when exit was called. */
+int execute_line(Shell *sh, Command *cmd) {
+    return run_node(sh, cmd);
+}
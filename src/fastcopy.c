@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include "fastcopy.h"
+#include "signals.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#define CHUNK (1 << 30)
+#define BUF_SIZE 65536
+
+enum { MODE_RANGE, MODE_SPLICE, MODE_SENDFILE, MODE_RW };
+
+static int unsupported(int err) {
+    return err == EINVAL || err == EXDEV || err == ENOSYS || err == EOPNOTSUPP || err == EBADF;
+}
+
+/* Ctrl-C between two calls ends the copy just as one during a call does. */
+static int stopped(void) {
+    if (!signals_interrupted()) return 0;
+    errno = EINTR;
+    return 1;
+}
+
+static ssize_t write_all(int fd, const char *buf, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t w = write(fd, buf + done, n - done);
+        if (w < 0) return -1;
+        done += (size_t)w;
+    }
+    return (ssize_t)done;
+}
+
+static ssize_t copy_rw(int in_fd, int out_fd, size_t max) {
+    char buf[BUF_SIZE];
+    ssize_t r = read(in_fd, buf, max < sizeof(buf) ? max : sizeof(buf));
+    if (r <= 0) return r;
+    return write_all(out_fd, buf, (size_t)r);
+}
+
+static int first_mode(int in_fd, int out_fd) {
+    struct stat in, out;
+    if (fstat(in_fd, &in) < 0 || fstat(out_fd, &out) < 0) return MODE_RW;
+    if (S_ISREG(in.st_mode) && S_ISREG(out.st_mode)) return MODE_RANGE;
+    if (S_ISFIFO(in.st_mode) || S_ISFIFO(out.st_mode)) return MODE_SPLICE;
+    if (S_ISREG(in.st_mode)) return MODE_SENDFILE;
+    return MODE_RW;
+}
+
+/* Copies until EOF on in_fd, starting with the cheapest kernel-side method
+ * for the pair of file types and dropping down a level whenever the kernel
+ * refuses one (O_APPEND targets, ttys, cross-filesystem ranges). A signal
+ * that interrupts a call ends the copy with EINTR: the shell only allows
+ * that for Ctrl-C while it runs a copy itself. */
+off_t fastcopy_fd(int in_fd, int out_fd) {
+    int mode = first_mode(in_fd, out_fd);
+    off_t total = 0;
+
+    for (;;) {
+        if (stopped()) return -1;
+        ssize_t n;
+        switch (mode) {
+        case MODE_RANGE:
+            n = copy_file_range(in_fd, NULL, out_fd, NULL, CHUNK, 0);
+            break;
+        case MODE_SPLICE:
+            n = splice(in_fd, NULL, out_fd, NULL, CHUNK, SPLICE_F_MOVE);
+            break;
+        case MODE_SENDFILE:
+            n = sendfile(out_fd, in_fd, NULL, CHUNK);
+            break;
+        default:
+            n = copy_rw(in_fd, out_fd, BUF_SIZE);
+            break;
+        }
+
+        if (n > 0) {
+            total += n;
+            continue;
+        }
+        if (n == 0) return total;
+        if (mode != MODE_RW && unsupported(errno)) {
+            mode = (mode == MODE_RANGE || mode == MODE_SPLICE) ? MODE_SENDFILE : MODE_RW;
+            continue;
+        }
+        return -1;
+    }
+}
+
+static int drain(int pipe_fd, int out_fd, size_t n, int *use_splice) {
+    while (n > 0) {
+        ssize_t w;
+        if (*use_splice) {
+            w = splice(pipe_fd, NULL, out_fd, NULL, n, SPLICE_F_MOVE);
+            if (w < 0 && unsupported(errno)) {
+                *use_splice = 0;
+                continue;
+            }
+        } else {
+            w = copy_rw(pipe_fd, out_fd, n);
+        }
+        if (w <= 0) return -1;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+/* in_fd must be a pipe. tee(2) duplicates what is buffered in it without
+ * consuming it, then exactly that many bytes are spliced on to file_fd.
+ * When out_fd is not a pipe the duplicate goes through a scratch pipe. */
+off_t fastcopy_tee(int in_fd, int out_fd, int file_fd) {
+    struct stat st;
+    int scratch[2] = { -1, -1 };
+    int dup_fd = out_fd;
+    if (fstat(out_fd, &st) < 0) return -1;
+    if (!S_ISFIFO(st.st_mode)) {
+        if (pipe2(scratch, O_CLOEXEC) < 0) return -1;
+        int size = fcntl(in_fd, F_GETPIPE_SZ);
+        if (size > 0) fcntl(scratch[1], F_SETPIPE_SZ, size);
+        dup_fd = scratch[1];
+    }
+
+    int out_splice = 1, file_splice = 1;
+    off_t total = 0;
+    for (;;) {
+        if (stopped()) {
+            total = -1;
+            break;
+        }
+        ssize_t n = tee(in_fd, dup_fd, CHUNK, 0);
+        if (n < 0) {
+            total = -1;
+            break;
+        }
+        if (n == 0) break;
+        if ((scratch[0] >= 0 && drain(scratch[0], out_fd, (size_t)n, &out_splice) < 0) ||
+            drain(in_fd, file_fd, (size_t)n, &file_splice) < 0) {
+            total = -1;
+            break;
+        }
+        total += n;
+    }
+
+    if (scratch[0] >= 0) {
+        close(scratch[0]);
+        close(scratch[1]);
+    }
+    return total;
+}
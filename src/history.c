@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include "history.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Entries already in the file are read through a private mapping; the line
+ * index over it is only built the first time an entry is asked for, so
+ * opening a large history costs an mmap and nothing more. Entries added by
+ * this shell live in buf and are appended to the file with O_APPEND, which
+ * lets several shells share one file. */
+static struct {
+    int fd;
+
+    const char *map;
+    size_t map_len;
+    size_t *map_off;
+    size_t nmap;
+    int indexed;
+
+    char *buf;
+    size_t buf_len;
+    size_t buf_cap;
+    size_t *buf_off;
+    size_t nbuf;
+    size_t buf_off_cap;
+} g_hist = { .fd = -1 };
+
+int history_open(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            g_hist.map = (const char *)map;
+            g_hist.map_len = (size_t)st.st_size;
+        }
+    }
+    g_hist.fd = fd;
+    return 0;
+}
+
+void history_close(void) {
+    if (g_hist.map) munmap((void *)g_hist.map, g_hist.map_len);
+    if (g_hist.fd >= 0) close(g_hist.fd);
+    free(g_hist.map_off);
+    free(g_hist.buf);
+    free(g_hist.buf_off);
+    memset(&g_hist, 0, sizeof(g_hist));
+    g_hist.fd = -1;
+}
+
+static int push_off(size_t **offs, size_t *n, size_t *cap, size_t off) {
+    if (*n == *cap) {
+        size_t newcap = *cap ? *cap * 2 : 1024;
+        size_t *p = (size_t *)realloc(*offs, sizeof(size_t) * newcap);
+        if (!p) return -1;
+        *offs = p;
+        *cap = newcap;
+    }
+    (*offs)[(*n)++] = off;
+    return 0;
+}
+
+static void build_index(void) {
+    if (g_hist.indexed) return;
+    g_hist.indexed = 1;
+
+    size_t cap = 0;
+    const char *p = g_hist.map;
+    const char *end = g_hist.map + g_hist.map_len;
+    while (p < end) {
+        const char *nl = (const char *)memchr(p, '\n', (size_t)(end - p));
+        if (!nl) nl = end;
+        if (nl > p && push_off(&g_hist.map_off, &g_hist.nmap, &cap, (size_t)(p - g_hist.map)) < 0) break;
+        p = nl + 1;
+    }
+}
+
+size_t history_count(void) {
+    build_index();
+    return g_hist.nmap + g_hist.nbuf;
+}
+
+/* Entries are numbered from 0, oldest first. */
+const char *history_get(size_t i, size_t *len) {
+    build_index();
+    const char *base;
+    size_t avail;
+    if (i < g_hist.nmap) {
+        base = g_hist.map + g_hist.map_off[i];
+        avail = g_hist.map_len - g_hist.map_off[i];
+    } else if (i - g_hist.nmap < g_hist.nbuf) {
+        base = g_hist.buf + g_hist.buf_off[i - g_hist.nmap];
+        avail = g_hist.buf_len - g_hist.buf_off[i - g_hist.nmap];
+    } else {
+        return NULL;
+    }
+    const char *nl = (const char *)memchr(base, '\n', avail);
+    *len = nl ? (size_t)(nl - base) : avail;
+    return base;
+}
+
+/* The newest entry, found without building the index. */
+static const char *last_entry(size_t *len) {
+    if (g_hist.nbuf) {
+        size_t off = g_hist.buf_off[g_hist.nbuf - 1];
+        *len = g_hist.buf_len - off - 1;
+        return g_hist.buf + off;
+    }
+
+    size_t end = g_hist.map_len;
+    while (end > 0 && g_hist.map[end - 1] == '\n') end--;
+    if (end == 0) return NULL;
+    const char *nl = (const char *)memrchr(g_hist.map, '\n', end);
+    size_t start = nl ? (size_t)(nl - g_hist.map) + 1 : 0;
+    *len = end - start;
+    return g_hist.map + start;
+}
+
+void history_add(const char *line, size_t len) {
+    while (len > 0 && (line[len - 1] == ' ' || line[len - 1] == '\t' || line[len - 1] == '\r')) len--;
+    size_t lead = 0;
+    while (lead < len && (line[lead] == ' ' || line[lead] == '\t')) lead++;
+    if (g_hist.fd < 0 || lead == len || memchr(line, '\n', len)) return;
+
+    size_t plen;
+    const char *prev = last_entry(&plen);
+    if (prev && plen == len && memcmp(prev, line, len) == 0) return;
+
+    if (g_hist.buf_len + len + 1 > g_hist.buf_cap) {
+        size_t cap = g_hist.buf_cap ? g_hist.buf_cap : 4096;
+        while (cap < g_hist.buf_len + len + 1) cap *= 2;
+        char *buf = (char *)realloc(g_hist.buf, cap);
+        if (!buf) return;
+        g_hist.buf = buf;
+        g_hist.buf_cap = cap;
+    }
+    if (push_off(&g_hist.buf_off, &g_hist.nbuf, &g_hist.buf_off_cap, g_hist.buf_len) < 0) return;
+
+    char *entry = g_hist.buf + g_hist.buf_len;
+    memcpy(entry, line, len);
+    entry[len] = '\n';
+    g_hist.buf_len += len + 1;
+
+    if (write(g_hist.fd, entry, len + 1) < 0) {
+        perror("myshell: history");
+        close(g_hist.fd);
+        g_hist.fd = -1;
+    }
+}
+
+/* Returns the newest entry before index `before` (or before the end when it
+ * is negative) that starts with, or when prefix is 0 contains, needle. */
+long history_search(const char *needle, size_t n, long before, int prefix) {
+    long count = (long)history_count();
+    if (before < 0 || before > count) before = count;
+    for (long i = before - 1; i >= 0; i--) {
+        size_t len;
+        const char *e = history_get((size_t)i, &len);
+        if (len < n) continue;
+        if (prefix ? memcmp(e, needle, n) == 0 : memmem(e, len, needle, n) != NULL) return i;
+    }
+    return -1;
+}
+
+/* Expands an event at the start of the line: !! (last), !n (entry n as
+ * `history` numbers it), !-n (n back) or !prefix. The rest of the line is
+ * kept. Returns 0 for no event, 1 with a malloc'd *out, -1 if not found. */
+int history_expand(const char *line, size_t len, char **out) {
+    if (g_hist.fd < 0 || len < 2 || line[0] != '!' || line[1] == ' ' || line[1] == '\t' || line[1] == '=') return 0;
+
+    long count = (long)history_count();
+    long idx = -1;
+    size_t used = 1;
+    if (line[1] == '!') {
+        idx = count - 1;
+        used = 2;
+    } else {
+        size_t start = (line[1] == '-') ? 2 : 1;
+        size_t i = start;
+        long n = 0;
+        while (i < len && line[i] >= '0' && line[i] <= '9' && n < 100000000) n = n * 10 + (line[i++] - '0');
+        if (i > start) {
+            idx = (start == 2) ? count - n : n - 1;
+            used = i;
+        }
+    }
+    if (used == 1) {
+        while (used < len && line[used] != ' ' && line[used] != '\t' && line[used] != '|' && line[used] != ';' &&
+               line[used] != '&' && line[used] != '<' && line[used] != '>') {
+            used++;
+        }
+        idx = history_search(line + 1, used - 1, -1, 1);
+    }
+
+    if (idx < 0 || idx >= count) {
+        fprintf(stderr, "myshell: %.*s: event not found\n", (int)used, line);
+        return -1;
+    }
+
+    size_t elen;
+    const char *e = history_get((size_t)idx, &elen);
+    char *s = (char *)malloc(elen + (len - used) + 1);
+    if (!s) return -1;
+    memcpy(s, e, elen);
+    memcpy(s + elen, line + used, len - used);
+    s[elen + len - used] = '\0';
+    *out = s;
+    return 1;
+}
@@ -0,0 +1,135 @@
+#include "input.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INPUT_BLOCK 65536
+
+static void input_reset(Input *in) {
+    memset(in, 0, sizeof(*in));
+    in->fd = -1;
+}
+
+int input_open_fd(Input *in, int fd) {
+    input_reset(in);
+    in->fd = fd;
+    in->interactive = isatty(fd);
+    in->buf = (char *)malloc(INPUT_BLOCK);
+    if (!in->buf) return -1;
+    in->cap = INPUT_BLOCK;
+    return 0;
+}
+
+int input_open_file(Input *in, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        input_reset(in);
+        if (st.st_size == 0) {
+            close(fd);
+            in->data = "";
+            return 0;
+        }
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) return -1;
+        madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+        in->data = (const char *)p;
+        in->len = (size_t)st.st_size;
+        in->map_len = in->len;
+        return 0;
+    }
+
+    if (input_open_fd(in, fd) < 0) {
+        close(fd);
+        return -1;
+    }
+    in->owns_fd = 1;
+    in->interactive = 0;
+    return 0;
+}
+
+void input_open_string(Input *in, const char *s) {
+    input_reset(in);
+    in->data = s;
+    in->len = strlen(s);
+}
+
+static const char *next_from_memory(Input *in, size_t *out_len) {
+    if (in->pos >= in->len) return NULL;
+    const char *line = in->data + in->pos;
+    const char *nl = (const char *)memchr(line, '\n', in->len - in->pos);
+    size_t n = nl ? (size_t)(nl - line) : in->len - in->pos;
+    in->pos += n + (nl ? 1 : 0);
+    *out_len = n;
+    return line;
+}
+
+static int fill(Input *in) {
+    if (in->start > 0) {
+        memmove(in->buf, in->buf + in->start, in->end - in->start);
+        in->end -= in->start;
+        in->start = 0;
+    }
+    if (in->end + 1 >= in->cap) {
+        char *tmp = (char *)realloc(in->buf, in->cap * 2);
+        if (!tmp) return -1;
+        in->buf = tmp;
+        in->cap *= 2;
+    }
+
+    if (in->wait && in->wait(in->wait_ctx, in->fd) < 0) return -1;
+
+    for (;;) {
+        ssize_t r = read(in->fd, in->buf + in->end, in->cap - in->end - 1);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (r == 0) in->eof = 1;
+        in->end += (size_t)r;
+        return (int)r;
+    }
+}
+
+const char *input_next(Input *in, size_t *out_len) {
+    if (in->data) return next_from_memory(in, out_len);
+
+    size_t scanned = in->start;
+    for (;;) {
+        char *nl = (char *)memchr(in->buf + scanned, '\n', in->end - scanned);
+        if (nl) {
+            char *line = in->buf + in->start;
+            *nl = '\0';
+            *out_len = (size_t)(nl - line);
+            in->start = (size_t)(nl - in->buf) + 1;
+            return line;
+        }
+
+        if (in->eof) {
+            if (in->start == in->end) return NULL;
+            char *line = in->buf + in->start;
+            in->buf[in->end] = '\0';
+            *out_len = in->end - in->start;
+            in->start = in->end;
+            return line;
+        }
+
+        size_t seen = in->end - in->start;
+        if (fill(in) < 0) return NULL;
+        scanned = in->start + seen;
+    }
+}
+
+void input_close(Input *in) {
+    if (in->owns_fd) close(in->fd);
+    if (in->map_len) munmap((void *)in->data, in->map_len);
+    free(in->buf);
+    input_reset(in);
+}
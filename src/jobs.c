@@ -1,6 +1,12 @@
 #include "jobs.h"
+#include "logger.h"
+#include "signals.h"
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 static char *xstrdup(const char *s) {
     size_t n = strlen(s);
@@ -11,48 +17,298 @@ static char *xstrdup(const char *s) {
 }
 
 void jobs_init(Jobs *jobs) {
-    jobs->head = NULL;
+    memset(jobs, 0, sizeof(*jobs));
 }
 
-int jobs_add(Jobs *jobs, pid_t pid, const char *cmdline) {
-    Job *j = (Job *)malloc(sizeof(Job));
-    if (!j) return -1;
-    j->pid = pid;
-    j->cmdline = xstrdup(cmdline ? cmdline : "");
-    if (!j->cmdline) {
-        free(j);
+static size_t pid_slot(const Jobs *jobs, pid_t pid) {
+    size_t h = (size_t)(unsigned)pid * 2654435761u;
+    size_t i = h & (jobs->pidcap - 1);
+    while (jobs->pidmap[i].pid && jobs->pidmap[i].pid != pid) i = (i + 1) & (jobs->pidcap - 1);
+    return i;
+}
+
+static int pidmap_grow(Jobs *jobs) {
+    size_t oldcap = jobs->pidcap;
+    JobPid *old = jobs->pidmap;
+
+    jobs->pidcap = oldcap ? oldcap * 2 : 64;
+    jobs->pidmap = (JobPid *)calloc(jobs->pidcap, sizeof(JobPid));
+    if (!jobs->pidmap) {
+        jobs->pidmap = old;
+        jobs->pidcap = oldcap;
         return -1;
     }
-    j->next = jobs->head;
-    jobs->head = j;
+    for (size_t i = 0; i < oldcap; i++) {
+        if (old[i].pid) jobs->pidmap[pid_slot(jobs, old[i].pid)] = old[i];
+    }
+    free(old);
     return 0;
 }
 
-char *jobs_take_cmdline(Jobs *jobs, pid_t pid) {
-    Job *prev = NULL;
-    Job *cur = jobs->head;
-    while (cur) {
-        if (cur->pid == pid) {
-            if (prev) prev->next = cur->next;
-            else jobs->head = cur->next;
-            char *s = cur->cmdline;
-            free(cur);
-            return s;
+static int pidmap_put(Jobs *jobs, pid_t pid, Job *job) {
+    if ((jobs->npids + 1) * 2 > jobs->pidcap && pidmap_grow(jobs) < 0) return -1;
+    size_t i = pid_slot(jobs, pid);
+    if (!jobs->pidmap[i].pid) jobs->npids++;
+    jobs->pidmap[i].pid = pid;
+    jobs->pidmap[i].job = job;
+    return 0;
+}
+
+static void pidmap_del(Jobs *jobs, pid_t pid) {
+    if (!jobs->pidcap) return;
+    size_t i = pid_slot(jobs, pid);
+    if (!jobs->pidmap[i].pid) return;
+
+    jobs->pidmap[i].pid = 0;
+    jobs->pidmap[i].job = NULL;
+    jobs->npids--;
+
+    size_t j = (i + 1) & (jobs->pidcap - 1);
+    while (jobs->pidmap[j].pid) {
+        JobPid e = jobs->pidmap[j];
+        jobs->pidmap[j].pid = 0;
+        jobs->pidmap[pid_slot(jobs, e.pid)] = e;
+        j = (j + 1) & (jobs->pidcap - 1);
+    }
+}
+
+static int alloc_id(Jobs *jobs) {
+    if (jobs->nfree > 0) return jobs->free_ids[--jobs->nfree];
+
+    if (jobs->count == jobs->cap) {
+        int newcap = jobs->cap ? jobs->cap * 2 : 16;
+        Job **t = (Job **)realloc(jobs->table, sizeof(Job *) * (size_t)newcap);
+        if (!t) return -1;
+        int *f = (int *)realloc(jobs->free_ids, sizeof(int) * (size_t)newcap);
+        if (!f) {
+            jobs->table = t;
+            return -1;
+        }
+        memset(t + jobs->cap, 0, sizeof(Job *) * (size_t)(newcap - jobs->cap));
+        jobs->table = t;
+        jobs->free_ids = f;
+        jobs->cap = newcap;
+    }
+    return ++jobs->count;
+}
+
+static void free_id(Jobs *jobs, int id) {
+    jobs->table[id - 1] = NULL;
+    if (id == jobs->count) {
+        jobs->count--;
+        return;
+    }
+    jobs->free_ids[jobs->nfree++] = id;
+}
+
+static void done_put(Jobs *jobs, int id, int status) {
+    int i = 0;
+    while (i < jobs->ndone && jobs->done[i].id != id) i++;
+    if (i == jobs->ndone) {
+        if (jobs->ndone == jobs->donecap) {
+            int cap = jobs->donecap ? jobs->donecap * 2 : 16;
+            JobDone *d = (JobDone *)realloc(jobs->done, sizeof(JobDone) * (size_t)cap);
+            if (!d) return;
+            jobs->done = d;
+            jobs->donecap = cap;
         }
-        prev = cur;
-        cur = cur->next;
+        jobs->ndone++;
+    }
+    jobs->done[i].id = id;
+    jobs->done[i].status = status;
+}
+
+/* Hands out and forgets the status of ended job id; -1 if there is none. */
+int jobs_take_status(Jobs *jobs, int id, int *status) {
+    for (int i = 0; i < jobs->ndone; i++) {
+        if (jobs->done[i].id != id) continue;
+        *status = jobs->done[i].status;
+        jobs->done[i] = jobs->done[--jobs->ndone];
+        return 0;
     }
+    return -1;
+}
+
+void jobs_forget_done(Jobs *jobs) {
+    jobs->ndone = 0;
+}
+
+Job *jobs_add(Jobs *jobs, pid_t pgid, const pid_t *pids, int npids, const char *cmdline) {
+    Job *j = (Job *)calloc(1, sizeof(Job));
+    if (!j) return NULL;
+    j->pgid = pgid;
+    j->cmdline = xstrdup(cmdline ? cmdline : "");
+    j->pids = (pid_t *)malloc(sizeof(pid_t) * (size_t)npids);
+    j->statuses = (int *)malloc(sizeof(int) * (size_t)npids);
+    if (!j->cmdline || !j->pids || !j->statuses) goto fail;
+    memcpy(j->pids, pids, sizeof(pid_t) * (size_t)npids);
+    for (int i = 0; i < npids; i++) j->statuses[i] = -1;
+    j->npids = npids;
+    j->remaining = npids;
+    usage_begin(&j->usage);
+
+    j->id = alloc_id(jobs);
+    if (j->id < 0) goto fail;
+    jobs->table[j->id - 1] = j;
+    int stale;
+    jobs_take_status(jobs, j->id, &stale);
+    jobs->last_id = j->id;
+
+    for (int i = 0; i < npids; i++) {
+        if (pids[i] && pidmap_put(jobs, pids[i], j) < 0) {
+            for (int k = 0; k < i; k++) pidmap_del(jobs, pids[k]);
+            free_id(jobs, j->id);
+            goto fail;
+        }
+    }
+    return j;
+
+fail:
+    free(j->cmdline);
+    free(j->pids);
+    free(j->statuses);
+    free(j);
     return NULL;
 }
 
-void jobs_cleanup(Jobs *jobs) {
-    Job *cur = jobs->head;
-    while (cur) {
-        Job *n = cur->next;
-        free(cur->cmdline);
-        free(cur);
-        cur = n;
+Job *jobs_get(Jobs *jobs, int id) {
+    if (id < 1 || id > jobs->count) return NULL;
+    return jobs->table[id - 1];
+}
+
+int jobs_live(const Jobs *jobs) {
+    return jobs->count - jobs->nfree;
+}
+
+Job *jobs_find_pid(Jobs *jobs, pid_t pid) {
+    if (!jobs->pidcap) return NULL;
+    return jobs->pidmap[pid_slot(jobs, pid)].job;
+}
+
+Coproc *jobs_find_coproc(Jobs *jobs, const char *name) {
+    for (int i = 0; i < jobs->count; i++) {
+        Job *j = jobs->table[i];
+        if (j && j->coproc && strcmp(j->coproc->name, name) == 0) return j->coproc;
+    }
+    for (Coproc *co = jobs->detached; co; co = co->next) {
+        if (strcmp(co->name, name) == 0) return co;
+    }
+    return NULL;
+}
+
+/* Keeps the launch attributes for the record written when the job ends. */
+void jobs_set_attrs(Job *job, const char *attrs) {
+    free(job->attrs);
+    job->attrs = attrs ? xstrdup(attrs) : NULL;
+}
+
+static void free_coproc(Coproc *co) {
+    if (!co) return;
+    if (co->to_fd >= 0) close(co->to_fd);
+    if (co->from_fd >= 0) close(co->from_fd);
+    free(co->name);
+    free(co->buf);
+    free(co);
+}
+
+/* Forgets a coprocess whose command has been reaped; -1 while it runs. */
+int jobs_drop_coproc(Jobs *jobs, Coproc *co) {
+    for (Coproc **p = &jobs->detached; *p; p = &(*p)->next) {
+        if (*p == co) {
+            *p = co->next;
+            free_coproc(co);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void jobs_remove(Jobs *jobs, Job *job) {
+    for (int i = 0; i < job->npids; i++) {
+        if (job->statuses[i] == -1) pidmap_del(jobs, job->pids[i]);
+    }
+    free_id(jobs, job->id);
+    if (job->coproc) {
+        job->coproc->next = jobs->detached;
+        jobs->detached = job->coproc;
+    }
+    free(job->attrs);
+    free(job->cmdline);
+    free(job->pids);
+    free(job->statuses);
+    free(job);
+}
+
+int jobs_reap(Jobs *jobs, const Reaped *r, int log_fd) {
+    pid_t pid = r->pid;
+    int status = r->status;
+    Job *j = jobs_find_pid(jobs, pid);
+    if (!j) return 0;
+
+    if (WIFSTOPPED(status)) {
+        j->stopped = 1;
+        return 1;
+    }
+    if (WIFCONTINUED(status)) {
+        j->stopped = 0;
+        return 1;
+    }
+
+    pidmap_del(jobs, pid);
+    for (int i = 0; i < j->npids; i++) {
+        if (j->pids[i] == pid) j->statuses[i] = status;
+    }
+    usage_add(&j->usage, &r->ru, &r->end);
+    if (--j->remaining == 0) {
+        done_put(jobs, j->id, j->statuses[j->npids - 1]);
+        LogRecord rec = { j->pids[0], j->cmdline, j->statuses, j->npids, 0, &j->usage, j->attrs };
+        logger_write(log_fd, &rec);
+        jobs_remove(jobs, j);
     }
-    jobs->head = NULL;
+    return 1;
 }
 
+int jobs_handle_reaped(Jobs *jobs, int reap_fd, int log_fd) {
+    Reaped buf[32];
+    int handled = 0;
+    for (;;) {
+        size_t n = signals_read_reaped(reap_fd, buf, 32);
+        for (size_t i = 0; i < n; i++) {
+            jobs_reap(jobs, &buf[i], log_fd);
+            handled++;
+        }
+        if (n < 32) return handled;
+    }
+}
+
+int jobs_signal(Job *job, int sig) {
+    if (job->pgid > 0) return kill(-job->pgid, sig);
+    int rc = 0;
+    for (int i = 0; i < job->npids; i++) {
+        if (job->statuses[i] == -1 && kill(job->pids[i], sig) < 0) rc = -1;
+    }
+    return rc;
+}
+
+void jobs_cleanup(Jobs *jobs) {
+    for (int i = 0; i < jobs->count; i++) {
+        Job *j = jobs->table[i];
+        if (!j) continue;
+        free_coproc(j->coproc);
+        free(j->attrs);
+        free(j->cmdline);
+        free(j->pids);
+        free(j->statuses);
+        free(j);
+    }
+    while (jobs->detached) {
+        Coproc *co = jobs->detached;
+        jobs->detached = co->next;
+        free_coproc(co);
+    }
+    free(jobs->done);
+    free(jobs->table);
+    free(jobs->free_ids);
+    free(jobs->pidmap);
+    memset(jobs, 0, sizeof(*jobs));
+}
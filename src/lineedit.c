@@ -0,0 +1,528 @@
+#define _GNU_SOURCE
+#include "lineedit.h"
+#include "history.h"
+#include "pathcache.h"
+#include "builtin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+/* Listing more completions than this asks first. */
+#define LIST_ASK 100
+
+enum {
+    KEY_CTRL_A = 1,
+    KEY_CTRL_B = 2,
+    KEY_CTRL_C = 3,
+    KEY_CTRL_D = 4,
+    KEY_CTRL_E = 5,
+    KEY_CTRL_F = 6,
+    KEY_CTRL_G = 7,
+    KEY_CTRL_H = 8,
+    KEY_TAB = 9,
+    KEY_CTRL_K = 11,
+    KEY_CTRL_L = 12,
+    KEY_CTRL_N = 14,
+    KEY_CTRL_P = 16,
+    KEY_CTRL_R = 18,
+    KEY_CTRL_U = 21,
+    KEY_CTRL_W = 23,
+    KEY_ESC = 27,
+    KEY_BACKSPACE = 127
+};
+
+int lineedit_init(LineEdit *le, int fd) {
+    memset(le, 0, sizeof(*le));
+    le->fd = fd;
+    const char *term = getenv("TERM");
+    if (!term || strcmp(term, "dumb") == 0 || !isatty(fd) || !isatty(STDOUT_FILENO)) return -1;
+    if (tcgetattr(fd, &le->cooked) < 0) return -1;
+
+    le->buf = (char *)malloc(256);
+    if (!le->buf) return -1;
+    le->cap = 256;
+    arena_init(&le->words);
+    return 0;
+}
+
+void lineedit_free(LineEdit *le) {
+    free(le->buf);
+    free(le->stash);
+    free(le->cands);
+    arena_free(&le->words);
+    memset(le, 0, sizeof(*le));
+}
+
+static int raw_on(LineEdit *le) {
+    if (tcgetattr(le->fd, &le->cooked) < 0) return -1;
+    struct termios raw = le->cooked;
+    raw.c_iflag &= ~(tcflag_t)(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_lflag &= ~(tcflag_t)(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    return tcsetattr(le->fd, TCSADRAIN, &raw);
+}
+
+static int next_byte(LineEdit *le) {
+    if (le->in_pos == le->in_len) {
+        if (le->wait && le->wait(le->wait_ctx, le->fd) < 0) return -1;
+        ssize_t r;
+        do {
+            r = read(le->fd, le->in, sizeof(le->in));
+        } while (r < 0 && errno == EINTR);
+        if (r <= 0) return -1;
+        le->in_pos = 0;
+        le->in_len = (size_t)r;
+    }
+    return (unsigned char)le->in[le->in_pos++];
+}
+
+static size_t term_cols(void) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) return ws.ws_col;
+    return 80;
+}
+
+/* Redraws the line in place. One that does not fit scrolls sideways so the
+ * cursor stays on screen. */
+static void refresh(LineEdit *le) {
+    size_t plen = strlen(le->prompt);
+    size_t cols = term_cols();
+    const char *b = le->buf;
+    size_t len = le->len;
+    size_t pos = le->pos;
+    while (plen + pos >= cols && pos > 0) {
+        b++;
+        len--;
+        pos--;
+    }
+    while (plen + len >= cols && len > pos) len--;
+
+    fputc('\r', stdout);
+    fputs(le->prompt, stdout);
+    fwrite(b, 1, len, stdout);
+    fputs("\x1b[0K\r", stdout);
+    if (plen + pos) printf("\x1b[%zuC", plen + pos);
+    fflush(stdout);
+}
+
+static int reserve(LineEdit *le, size_t n) {
+    if (n + 1 <= le->cap) return 0;
+    size_t cap = le->cap * 2;
+    while (cap < n + 1) cap *= 2;
+    char *buf = (char *)realloc(le->buf, cap);
+    if (!buf) return -1;
+    le->buf = buf;
+    le->cap = cap;
+    return 0;
+}
+
+static void insert(LineEdit *le, const char *s, size_t n) {
+    if (reserve(le, le->len + n) < 0) return;
+    memmove(le->buf + le->pos + n, le->buf + le->pos, le->len - le->pos);
+    memcpy(le->buf + le->pos, s, n);
+    le->len += n;
+    le->pos += n;
+    le->buf[le->len] = '\0';
+}
+
+/* Removes [from, to) and leaves the cursor at from. */
+static void erase(LineEdit *le, size_t from, size_t to) {
+    memmove(le->buf + from, le->buf + to, le->len - to);
+    le->len -= to - from;
+    le->pos = from;
+    le->buf[le->len] = '\0';
+}
+
+static void set_line(LineEdit *le, const char *s, size_t n) {
+    if (reserve(le, n) < 0) return;
+    memcpy(le->buf, s, n);
+    le->buf[n] = '\0';
+    le->len = n;
+    le->pos = n;
+}
+
+/* Up and Down walk the history; the line being typed is kept in stash. The
+ * history index is only built the first time Up is pressed. */
+static void history_move(LineEdit *le, int up) {
+    if (up) {
+        if (le->hist == 0) return;
+        if (le->hist < 0) {
+            long count = (long)history_count();
+            if (count == 0) return;
+            free(le->stash);
+            le->stash = strdup(le->buf);
+            le->hist = count;
+        }
+        le->hist--;
+    } else {
+        if (le->hist < 0) return;
+        if (++le->hist >= (long)history_count()) {
+            le->hist = -1;
+            set_line(le, le->stash ? le->stash : "", le->stash ? strlen(le->stash) : 0);
+            return;
+        }
+    }
+    size_t n;
+    const char *e = history_get((size_t)le->hist, &n);
+    if (e) set_line(le, e, n);
+}
+
+/* Ctrl-R: searches back through history as the query is typed, Ctrl-R
+ * again finds the next older match. Returns the key that ended the search,
+ * with the match left in the line, or 0 after Ctrl-G restored the line. */
+static int search(LineEdit *le) {
+    const char *prompt = le->prompt;
+    char query[128];
+    char label[sizeof(query) + 32];
+    size_t qlen = 0;
+    long at = -1;
+    char *orig = strdup(le->buf);
+    int c;
+
+    for (;;) {
+        snprintf(label, sizeof(label), "(reverse-i-search)`%.*s': ", (int)qlen, query);
+        le->prompt = label;
+        refresh(le);
+
+        c = next_byte(le);
+        long from;
+        if (c == KEY_CTRL_R) {
+            from = at;
+        } else if (c == KEY_BACKSPACE || c == KEY_CTRL_H) {
+            if (qlen) qlen--;
+            from = -1;
+        } else if (c >= 32 && c != KEY_BACKSPACE) {
+            if (qlen < sizeof(query) - 1) query[qlen++] = (char)c;
+            from = at < 0 ? -1 : at + 1;
+        } else {
+            break;
+        }
+        if (qlen == 0) continue;
+
+        long i = history_search(query, qlen, from, 0);
+        if (i < 0) {
+            fputc('\a', stdout);
+            continue;
+        }
+        at = i;
+        size_t n;
+        const char *e = history_get((size_t)i, &n);
+        set_line(le, e, n);
+        const char *hit = (const char *)memmem(le->buf, le->len, query, qlen);
+        if (hit) le->pos = (size_t)(hit - le->buf);
+    }
+
+    if (c == KEY_CTRL_G) {
+        if (orig) set_line(le, orig, strlen(orig));
+        c = 0;
+    }
+    free(orig);
+    le->prompt = prompt;
+    return c;
+}
+
+static int is_break(char c) {
+    return c == ' ' || c == '\t' || c == '|' || c == ';' || c == '&' || c == '<' || c == '>';
+}
+
+/* Whether the word starting at ws names a command rather than an argument. */
+static int command_position(const char *buf, size_t ws) {
+    static const char *const kw[] = { "if", "then", "elif", "else", "do", "while", "until", "time" };
+    size_t i = ws;
+    while (i > 0 && (buf[i - 1] == ' ' || buf[i - 1] == '\t')) i--;
+    if (i == 0) return 1;
+    char c = buf[i - 1];
+    if (c == '|' || c == ';' || c == '&') return 1;
+    if (c == '<' || c == '>') return 0;
+
+    size_t end = i;
+    while (i > 0 && !is_break(buf[i - 1])) i--;
+    if (memchr(buf + i, '=', end - i)) return command_position(buf, i);
+    for (size_t k = 0; k < sizeof(kw) / sizeof(kw[0]); k++) {
+        if (strlen(kw[k]) == end - i && memcmp(kw[k], buf + i, end - i) == 0) return command_position(buf, i);
+    }
+    return 0;
+}
+
+static void add_cand(const char *name, void *ctx) {
+    LineEdit *le = (LineEdit *)ctx;
+    if (le->ncands == le->cands_cap) {
+        size_t cap = le->cands_cap ? le->cands_cap * 2 : 64;
+        const char **c = (const char **)realloc(le->cands, sizeof(char *) * cap);
+        if (!c) return;
+        le->cands = c;
+        le->cands_cap = cap;
+    }
+    char *copy = arena_strndup(&le->words, name, strlen(name));
+    if (copy) le->cands[le->ncands++] = copy;
+}
+
+/* Candidates are whole words (directory part included, a trailing / on
+ * directories); le->skip is how much of each the listing leaves out. */
+static void complete_files(LineEdit *le, const char *word, size_t n) {
+    const char *slash = (const char *)memrchr(word, '/', n);
+    size_t dlen = slash ? (size_t)(slash - word) + 1 : 0;
+    const char *base = word + dlen;
+    size_t blen = n - dlen;
+    le->skip = dlen;
+
+    char dir[PATH_MAX];
+    if (dlen == 0) snprintf(dir, sizeof(dir), ".");
+    else snprintf(dir, sizeof(dir), "%.*s", (int)dlen, word);
+    DIR *d = opendir(dir);
+    if (!d) return;
+
+    char full[PATH_MAX];
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        const char *name = de->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        if (name[0] == '.' && (blen == 0 || base[0] != '.')) continue;
+        if (strncmp(name, base, blen) != 0) continue;
+
+        int is_dir = de->d_type == DT_DIR;
+        if (de->d_type == DT_LNK || de->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = fstatat(dirfd(d), name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        }
+        snprintf(full, sizeof(full), "%.*s%s%s", (int)dlen, word, name, is_dir ? "/" : "");
+        add_cand(full, le);
+    }
+    closedir(d);
+}
+
+static int cmp_cand(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static void list_cands(LineEdit *le) {
+    fputc('\n', stdout);
+    if (le->ncands > LIST_ASK) {
+        printf("Display all %zu possibilities? (y or n)", le->ncands);
+        fflush(stdout);
+        int c = next_byte(le);
+        fputc('\n', stdout);
+        if (c != 'y' && c != 'Y') return;
+    }
+
+    size_t width = 0;
+    for (size_t i = 0; i < le->ncands; i++) {
+        size_t w = strlen(le->cands[i] + le->skip);
+        if (w > width) width = w;
+    }
+    width += 2;
+    size_t per_row = term_cols() / width;
+    if (per_row == 0) per_row = 1;
+    size_t rows = (le->ncands + per_row - 1) / per_row;
+    for (size_t r = 0; r < rows; r++) {
+        for (size_t i = r; i < le->ncands; i += rows) {
+            if (i + rows >= le->ncands) fputs(le->cands[i] + le->skip, stdout);
+            else printf("%-*s", (int)width, le->cands[i] + le->skip);
+        }
+        fputc('\n', stdout);
+    }
+}
+
+/* Tab: completes the word before the cursor as a command (builtins and the
+ * PATH index) or as a file name, up to what all candidates share. A second
+ * Tab lists them. */
+static void complete(LineEdit *le) {
+    size_t ws = le->pos;
+    while (ws > 0 && !is_break(le->buf[ws - 1])) ws--;
+    size_t n = le->pos - ws;
+
+    arena_reset(&le->words);
+    le->ncands = 0;
+    le->skip = 0;
+    char *word = arena_strndup(&le->words, le->buf + ws, n);
+    if (!word) return;
+
+    if (command_position(le->buf, ws) && !memchr(word, '/', n)) {
+        const char *name;
+        for (size_t i = 0; (name = builtin_name(i)) != NULL; i++) {
+            if (strncmp(name, word, n) == 0) add_cand(name, le);
+        }
+        pathcache_complete(word, add_cand, le);
+    } else {
+        complete_files(le, word, n);
+    }
+    if (le->ncands == 0) {
+        fputc('\a', stdout);
+        return;
+    }
+
+    qsort(le->cands, le->ncands, sizeof(char *), cmp_cand);
+    size_t k = 1;
+    for (size_t i = 1; i < le->ncands; i++) {
+        if (strcmp(le->cands[i], le->cands[k - 1]) != 0) le->cands[k++] = le->cands[i];
+    }
+    le->ncands = k;
+
+    const char *first = le->cands[0];
+    const char *last = le->cands[le->ncands - 1];
+    size_t common = 0;
+    while (first[common] && first[common] == last[common]) common++;
+
+    if (le->ncands == 1) {
+        erase(le, ws, le->pos);
+        insert(le, first, common);
+        if (first[common - 1] != '/') insert(le, " ", 1);
+    } else if (common > n) {
+        erase(le, ws, le->pos);
+        insert(le, first, common);
+    } else if (le->last_tab) {
+        list_cands(le);
+    } else {
+        fputc('\a', stdout);
+    }
+}
+
+static void escape(LineEdit *le) {
+    int a = next_byte(le);
+    if (a != '[' && a != 'O') return;
+    int b = next_byte(le);
+    if (b >= '0' && b <= '9') {
+        if (next_byte(le) != '~') return;
+        if (b == '1' || b == '7') b = 'H';
+        else if (b == '4' || b == '8') b = 'F';
+        else if (b == '3' && le->pos < le->len) erase(le, le->pos, le->pos + 1);
+    }
+    switch (b) {
+    case 'A':
+        history_move(le, 1);
+        break;
+    case 'B':
+        history_move(le, 0);
+        break;
+    case 'C':
+        if (le->pos < le->len) le->pos++;
+        break;
+    case 'D':
+        if (le->pos > 0) le->pos--;
+        break;
+    case 'H':
+        le->pos = 0;
+        break;
+    case 'F':
+        le->pos = le->len;
+        break;
+    }
+}
+
+/* Reads one line with the terminal in raw mode; the terminal is back in its
+ * own mode when this returns. NULL on end of input. After Ctrl-C the line
+ * is empty and le->interrupted is set. */
+const char *lineedit_read(LineEdit *le, const char *prompt, size_t *out_len) {
+    fflush(stdout);
+    if (raw_on(le) < 0) return NULL;
+
+    le->prompt = prompt;
+    le->len = 0;
+    le->pos = 0;
+    le->buf[0] = '\0';
+    le->hist = -1;
+    le->last_tab = 0;
+    le->interrupted = 0;
+    refresh(le);
+
+    int eof = 0;
+    for (;;) {
+        int c = next_byte(le);
+        if (c == KEY_CTRL_R) c = search(le);
+        if (c < 0) {
+            eof = 1;
+            break;
+        }
+
+        int tab = 0;
+        if (c == '\r' || c == '\n') break;
+        if (c == KEY_CTRL_C) {
+            le->interrupted = 1;
+            break;
+        }
+        if (c == KEY_CTRL_D && le->len == 0) {
+            eof = 1;
+            break;
+        }
+
+        switch (c) {
+        case 0:
+            break;
+        case KEY_CTRL_A:
+            le->pos = 0;
+            break;
+        case KEY_CTRL_B:
+            if (le->pos > 0) le->pos--;
+            break;
+        case KEY_CTRL_D:
+            if (le->pos < le->len) erase(le, le->pos, le->pos + 1);
+            break;
+        case KEY_CTRL_E:
+            le->pos = le->len;
+            break;
+        case KEY_CTRL_F:
+            if (le->pos < le->len) le->pos++;
+            break;
+        case KEY_CTRL_H:
+        case KEY_BACKSPACE:
+            if (le->pos > 0) erase(le, le->pos - 1, le->pos);
+            break;
+        case KEY_TAB:
+            complete(le);
+            tab = 1;
+            break;
+        case KEY_CTRL_K:
+            erase(le, le->pos, le->len);
+            break;
+        case KEY_CTRL_L:
+            fputs("\x1b[H\x1b[2J", stdout);
+            break;
+        case KEY_CTRL_N:
+            history_move(le, 0);
+            break;
+        case KEY_CTRL_P:
+            history_move(le, 1);
+            break;
+        case KEY_CTRL_U:
+            erase(le, 0, le->pos);
+            break;
+        case KEY_CTRL_W: {
+            size_t p = le->pos;
+            while (p > 0 && le->buf[p - 1] == ' ') p--;
+            while (p > 0 && le->buf[p - 1] != ' ') p--;
+            erase(le, p, le->pos);
+            break;
+        }
+        case KEY_ESC:
+            escape(le);
+            break;
+        default:
+            if (c >= 32) {
+                char ch = (char)c;
+                insert(le, &ch, 1);
+            }
+            break;
+        }
+        le->last_tab = tab;
+        refresh(le);
+    }
+
+    le->pos = le->len;
+    refresh(le);
+    fputs(le->interrupted ? "^C\n" : "\n", stdout);
+    fflush(stdout);
+    tcsetattr(le->fd, TCSADRAIN, &le->cooked);
+
+    if (le->interrupted) le->len = 0;
+    if (eof && le->len == 0) return NULL;
+    le->buf[le->len] = '\0';
+    *out_len = le->len;
+    return le->buf;
+}
@@ -1,41 +1,439 @@
+#define _GNU_SOURCE
 #include "logger.h"
+#include "size.h"
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 
+#define RING_SLOTS 1024
+#define SLOT_INLINE 240
+#define BATCH_MAX (IOV_MAX < RING_SLOTS ? IOV_MAX : RING_SLOTS)
+
+typedef struct Slot {
+    size_t len;
+    char *heap;
+    char data[SLOT_INLINE];
+} Slot;
+
+typedef struct LineBuf {
+    char *p;
+    size_t len;
+    size_t cap;
+    char stack[512];
+} LineBuf;
+
+static struct {
+    int fd;
+    char *path;
+    off_t size;
+    off_t max;
+    int json;
+    int async;
+    int drop;
+    unsigned long dropped;
+
+    Slot *ring;
+    atomic_size_t head;
+    atomic_size_t tail;
+    atomic_int writer_idle;
+    atomic_int producer_waiting;
+    atomic_int stop;
+    int wake_fd;
+    int space_fd;
+    pthread_t thread;
+} g_log = { .fd = -1, .wake_fd = -1, .space_fd = -1 };
+
+static char *xstrdup(const char *s) {
+    size_t n = strlen(s);
+    char *p = (char *)malloc(n + 1);
+    if (!p) return NULL;
+    memcpy(p, s, n + 1);
+    return p;
+}
+
+static void rotate(void) {
+    size_t n = strlen(g_log.path);
+    char *old = (char *)malloc(n + 3);
+    if (!old) return;
+    memcpy(old, g_log.path, n);
+    memcpy(old + n, ".1", 3);
+
+    if (rename(g_log.path, old) == 0) {
+        int fd = open(g_log.path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd >= 0) {
+            dup2(fd, g_log.fd);
+            close(fd);
+            g_log.size = 0;
+        }
+    }
+    free(old);
+}
+
+static void write_out(struct iovec *iov, int cnt, size_t bytes) {
+    if (g_log.max > 0 && g_log.size > 0 && g_log.size + (off_t)bytes > g_log.max) rotate();
+
+    while (cnt > 0) {
+        ssize_t w = writev(g_log.fd, iov, cnt);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        g_log.size += w;
+        while (cnt > 0 && (size_t)w >= iov->iov_len) {
+            w -= (ssize_t)iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= (size_t)w;
+        }
+    }
+}
+
+static void notify(int fd) {
+    uint64_t one = 1;
+    while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+static void wait_event(int fd) {
+    uint64_t v;
+    while (read(fd, &v, sizeof(v)) < 0 && errno == EINTR) {}
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    struct iovec iov[BATCH_MAX];
+
+    for (;;) {
+        size_t tail = atomic_load_explicit(&g_log.tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&g_log.head, memory_order_acquire);
+
+        if (head == tail) {
+            if (atomic_load(&g_log.stop)) return NULL;
+            atomic_store(&g_log.writer_idle, 1);
+            if (atomic_load(&g_log.head) == tail && !atomic_load(&g_log.stop)) wait_event(g_log.wake_fd);
+            atomic_store(&g_log.writer_idle, 0);
+            continue;
+        }
+
+        int cnt = 0;
+        size_t bytes = 0;
+        for (size_t i = tail; i != head && cnt < BATCH_MAX; i++, cnt++) {
+            Slot *s = &g_log.ring[i % RING_SLOTS];
+            iov[cnt].iov_base = s->heap ? s->heap : s->data;
+            iov[cnt].iov_len = s->len;
+            bytes += s->len;
+        }
+        write_out(iov, cnt, bytes);
+
+        for (int i = 0; i < cnt; i++) {
+            Slot *s = &g_log.ring[(tail + (size_t)i) % RING_SLOTS];
+            free(s->heap);
+            s->heap = NULL;
+        }
+        atomic_store(&g_log.tail, tail + (size_t)cnt);
+        if (atomic_exchange(&g_log.producer_waiting, 0)) notify(g_log.space_fd);
+    }
+}
+
+static int start_writer(void) {
+    atomic_store(&g_log.head, 0);
+    atomic_store(&g_log.tail, 0);
+    atomic_store(&g_log.writer_idle, 0);
+    atomic_store(&g_log.producer_waiting, 0);
+    atomic_store(&g_log.stop, 0);
+    g_log.ring = (Slot *)calloc(RING_SLOTS, sizeof(Slot));
+    g_log.wake_fd = eventfd(0, EFD_CLOEXEC);
+    g_log.space_fd = eventfd(0, EFD_CLOEXEC);
+    if (!g_log.ring || g_log.wake_fd < 0 || g_log.space_fd < 0) goto fail;
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&g_log.thread, NULL, writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err == 0) return 0;
+
+fail:
+    free(g_log.ring);
+    g_log.ring = NULL;
+    if (g_log.wake_fd >= 0) close(g_log.wake_fd);
+    if (g_log.space_fd >= 0) close(g_log.space_fd);
+    g_log.wake_fd = g_log.space_fd = -1;
+    return -1;
+}
+
+static void configure(void) {
+    g_log.json = g_log.async = g_log.drop = 0;
+    g_log.max = 0;
+    g_log.dropped = 0;
+
+    const char *format = getenv("MYSHELL_LOG_FORMAT");
+    if (format && strcmp(format, "jsonl") == 0) g_log.json = 1;
+    else if (format && strcmp(format, "text") != 0) fprintf(stderr, "myshell: MYSHELL_LOG_FORMAT must be text or jsonl\n");
+
+    const char *mode = getenv("MYSHELL_LOG_MODE");
+    if (mode && strcmp(mode, "async") == 0) g_log.async = 1;
+    else if (mode && strcmp(mode, "sync") != 0) fprintf(stderr, "myshell: MYSHELL_LOG_MODE must be sync or async\n");
+
+    const char *full = getenv("MYSHELL_LOG_FULL");
+    if (full && strcmp(full, "drop") == 0) g_log.drop = 1;
+    else if (full && strcmp(full, "block") != 0) fprintf(stderr, "myshell: MYSHELL_LOG_FULL must be block or drop\n");
+
+    const char *max = getenv("MYSHELL_LOG_MAX");
+    if (max) {
+        g_log.max = (off_t)size_parse(max);
+        if (g_log.max < 0) {
+            fprintf(stderr, "myshell: MYSHELL_LOG_MAX must be a size like 512K or 10M\n");
+            g_log.max = 0;
+        }
+    }
+}
+
 int logger_open(const char *path) {
-    return open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) return -1;
+
+    configure();
+    g_log.fd = fd;
+    g_log.path = xstrdup(path);
+
+    struct stat st;
+    if (fstat(fd, &st) == 0) g_log.size = st.st_size;
+    if (!g_log.path) g_log.max = 0;
+
+    if (g_log.async && start_writer() < 0) {
+        perror("myshell: async log");
+        g_log.async = 0;
+    }
+    return fd;
 }
 
-void logger_log(int fd, pid_t pid, const char *cmdline, int status) {
-    if (fd < 0) return;
+static int status_code(int status, int *sig) {
+    *sig = 0;
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) {
+        *sig = WTERMSIG(status);
+        return 128 + *sig;
+    }
+    return -1;
+}
+
+static void put(LineBuf *b, const char *fmt, ...) {
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(b->p + b->len, b->cap - b->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if (b->len + (size_t)n < b->cap) {
+            b->len += (size_t)n;
+            return;
+        }
 
-    int code = -1;
-    int sig = 0;
+        size_t cap = b->cap * 2;
+        while (cap <= b->len + (size_t)n) cap *= 2;
+        char *p = (char *)malloc(cap);
+        if (!p) return;
+        memcpy(p, b->p, b->len);
+        if (b->p != b->stack) free(b->p);
+        b->p = p;
+        b->cap = cap;
+    }
+}
 
-    if (WIFEXITED(status)) {
-        code = WEXITSTATUS(status);
-    } else if (WIFSIGNALED(status)) {
-        sig = WTERMSIG(status);
-        code = 128 + sig;
+static void submit(LineBuf *b) {
+    if (!g_log.async) {
+        struct iovec iov = { b->p, b->len };
+        write_out(&iov, 1, b->len);
+        return;
     }
 
-    char buf[512];
-    if (sig) {
-        int n = snprintf(buf, sizeof(buf),
-                         "[pid=%d] cmd=\"%s\" status=%d signal=%d\n",
-                         (int)pid, cmdline ? cmdline : "", code, sig);
-        if (n > 0) write(fd, buf, (size_t)n);
+    size_t head = atomic_load_explicit(&g_log.head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&g_log.tail, memory_order_acquire) == RING_SLOTS) {
+        if (g_log.drop) {
+            g_log.dropped++;
+            return;
+        }
+        atomic_store(&g_log.producer_waiting, 1);
+        if (head - atomic_load(&g_log.tail) == RING_SLOTS) wait_event(g_log.space_fd);
+    }
+
+    Slot *s = &g_log.ring[head % RING_SLOTS];
+    s->len = b->len;
+    if (b->len <= SLOT_INLINE) {
+        memcpy(s->data, b->p, b->len);
+    } else if (b->p != b->stack) {
+        s->heap = b->p;
+        b->p = b->stack;
     } else {
-        int n = snprintf(buf, sizeof(buf),
-                         "[pid=%d] cmd=\"%s\" status=%d\n",
-                         (int)pid, cmdline ? cmdline : "", code);
-        if (n > 0) write(fd, buf, (size_t)n);
+        s->heap = (char *)malloc(b->len);
+        if (!s->heap) return;
+        memcpy(s->heap, b->p, b->len);
     }
+    atomic_store(&g_log.head, head + 1);
+    if (atomic_exchange(&g_log.writer_idle, 0)) notify(g_log.wake_fd);
 }
 
-void logger_close(int fd) {
-    if (fd >= 0) close(fd);
+void logger_log(int fd, pid_t pid, const char *cmdline, int status) {
+    LogRecord rec = { pid, cmdline, &status, 1, 0, NULL, NULL };
+    logger_write(fd, &rec);
+}
+
+static void put_json_string(LineBuf *b, const char *s) {
+    put(b, "\"");
+    const char *run = s;
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        if (s > run) put(b, "%.*s", (int)(s - run), run);
+        switch (c) {
+        case '"': put(b, "\\\""); break;
+        case '\\': put(b, "\\\\"); break;
+        case '\n': put(b, "\\n"); break;
+        case '\t': put(b, "\\t"); break;
+        default: put(b, "\\u%04x", c); break;
+        }
+        run = s + 1;
+    }
+    if (s > run) put(b, "%.*s", (int)(s - run), run);
+    put(b, "\"");
+}
+
+/* A command that never started has no pid; its record says so instead. */
+void logger_not_found(int fd, const char *cmdline, long lineno) {
+    if (fd < 0 || fd != g_log.fd) return;
+
+    LineBuf b;
+    b.p = b.stack;
+    b.len = 0;
+    b.cap = sizeof(b.stack);
+
+    if (g_log.json) {
+        put(&b, "{\"error\":\"not found\"");
+        if (lineno > 0) put(&b, ",\"line\":%ld", lineno);
+        put(&b, ",\"cmd\":");
+        put_json_string(&b, cmdline ? cmdline : "");
+        put(&b, ",\"status\":127}\n");
+    } else {
+        put(&b, "[not-found]");
+        if (lineno > 0) put(&b, " line=%ld", lineno);
+        put(&b, " cmd=\"%s\" status=127\n", cmdline ? cmdline : "");
+    }
+    submit(&b);
+    if (b.p != b.stack) free(b.p);
+}
+
+static void format_json(LineBuf *b, const LogRecord *rec, int code, int sig) {
+    put(b, "{\"pid\":%d", (int)rec->pid);
+    if (rec->lineno > 0) put(b, ",\"line\":%ld", rec->lineno);
+    put(b, ",\"cmd\":");
+    put_json_string(b, rec->cmdline ? rec->cmdline : "");
+    put(b, ",\"status\":%d", code);
+    if (sig) put(b, ",\"signal\":%d", sig);
+    if (rec->nstages > 1) {
+        for (int i = 0; i < rec->nstages; i++) {
+            int s;
+            put(b, "%s%d", i ? "," : ",\"stages\":[", status_code(rec->statuses[i], &s));
+        }
+        put(b, "]");
+    }
+    if (rec->usage) {
+        const Usage *u = rec->usage;
+        put(b, ",\"wall\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld",
+            usage_wall(u), usage_seconds(&u->ru.ru_utime), usage_seconds(&u->ru.ru_stime),
+            u->ru.ru_maxrss, u->ru.ru_nvcsw, u->ru.ru_nivcsw);
+    }
+    if (rec->attrs) {
+        put(b, ",\"attrs\":");
+        put_json_string(b, rec->attrs);
+    }
+    put(b, "}\n");
 }
 
+void logger_write(int fd, const LogRecord *rec) {
+    if (fd < 0 || fd != g_log.fd || rec->nstages < 1) return;
+
+    int sig;
+    int code = status_code(rec->statuses[rec->nstages - 1], &sig);
+
+    LineBuf b;
+    b.p = b.stack;
+    b.len = 0;
+    b.cap = sizeof(b.stack);
+
+    if (g_log.json) {
+        format_json(&b, rec, code, sig);
+        submit(&b);
+        if (b.p != b.stack) free(b.p);
+        return;
+    }
+
+    put(&b, "[pid=%d]", (int)rec->pid);
+    if (rec->lineno > 0) put(&b, " line=%ld", rec->lineno);
+    put(&b, " cmd=\"%s\" status=%d", rec->cmdline ? rec->cmdline : "", code);
+    if (sig) put(&b, " signal=%d", sig);
+    if (rec->nstages > 1) {
+        for (int i = 0; i < rec->nstages; i++) {
+            int s;
+            put(&b, "%s%d", i ? "," : " stages=", status_code(rec->statuses[i], &s));
+        }
+    }
+    if (rec->usage) {
+        const Usage *u = rec->usage;
+        put(&b, " wall=%.6f user=%.6f sys=%.6f maxrss=%ld nvcsw=%ld nivcsw=%ld",
+            usage_wall(u), usage_seconds(&u->ru.ru_utime), usage_seconds(&u->ru.ru_stime),
+            u->ru.ru_maxrss, u->ru.ru_nvcsw, u->ru.ru_nivcsw);
+    }
+    if (rec->attrs) put(&b, " %s", rec->attrs);
+    put(&b, "\n");
+
+    submit(&b);
+    if (b.p != b.stack) free(b.p);
+}
+
+void logger_close(int fd) {
+    if (fd < 0) return;
+    if (fd != g_log.fd) {
+        close(fd);
+        return;
+    }
+
+    if (g_log.async) {
+        atomic_store(&g_log.stop, 1);
+        notify(g_log.wake_fd);
+        pthread_join(g_log.thread, NULL);
+        free(g_log.ring);
+        close(g_log.wake_fd);
+        close(g_log.space_fd);
+        g_log.ring = NULL;
+        g_log.async = 0;
+    }
+
+    if (g_log.dropped) {
+        char buf[64];
+        int n = snprintf(buf, sizeof(buf), g_log.json ? "{\"dropped\":%lu}\n" : "[logger] dropped=%lu\n", g_log.dropped);
+        struct iovec iov = { buf, (size_t)n };
+        write_out(&iov, 1, (size_t)n);
+        fprintf(stderr, "myshell: log buffer full, %lu records dropped\n", g_log.dropped);
+    }
+
+    close(fd);
+    free(g_log.path);
+    g_log.path = NULL;
+    g_log.fd = -1;
+}
@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define NAME_MAX_LEN 255
+
+typedef struct Stat {
+    char *name;
+    size_t name_len;
+    unsigned long count;
+    unsigned long failures;
+    double *walls;
+    size_t nwalls;
+    size_t cap;
+} Stat;
+
+typedef struct Table {
+    Stat *slots;
+    size_t cap;
+    size_t count;
+} Table;
+
+typedef struct Record {
+    char name[NAME_MAX_LEN + 1];
+    size_t name_len;
+    int status;
+    int has_status;
+    double wall;
+    int has_wall;
+} Record;
+
+static size_t hash_name(const char *s, size_t n) {
+    size_t h = 14695981039346656037UL;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+static size_t slot_for(const Table *t, const char *name, size_t n) {
+    size_t i = hash_name(name, n) & (t->cap - 1);
+    while (t->slots[i].name) {
+        if (t->slots[i].name_len == n && memcmp(t->slots[i].name, name, n) == 0) break;
+        i = (i + 1) & (t->cap - 1);
+    }
+    return i;
+}
+
+static int table_grow(Table *t) {
+    size_t oldcap = t->cap;
+    Stat *old = t->slots;
+
+    t->cap = oldcap ? oldcap * 2 : 256;
+    t->slots = (Stat *)calloc(t->cap, sizeof(Stat));
+    if (!t->slots) {
+        t->slots = old;
+        t->cap = oldcap;
+        return -1;
+    }
+    for (size_t i = 0; i < oldcap; i++) {
+        if (old[i].name) t->slots[slot_for(t, old[i].name, old[i].name_len)] = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+static Stat *table_get(Table *t, const char *name, size_t n) {
+    if ((t->count + 1) * 2 > t->cap && table_grow(t) < 0) return NULL;
+    Stat *s = &t->slots[slot_for(t, name, n)];
+    if (s->name) return s;
+
+    s->name = (char *)malloc(n + 1);
+    if (!s->name) return NULL;
+    memcpy(s->name, name, n);
+    s->name[n] = '\0';
+    s->name_len = n;
+    t->count++;
+    return s;
+}
+
+static void add_name_byte(Record *r, char c) {
+    if (r->name_len < NAME_MAX_LEN) r->name[r->name_len++] = c;
+}
+
+/* `time cmd` is counted under cmd. */
+static int is_time(const Record *r) {
+    return r->name_len == 4 && memcmp(r->name, "time", 4) == 0;
+}
+
+/* Reads a JSON string starting after the opening quote. When r is set, the
+ * first word of the decoded string after any time keyword becomes the
+ * record's command name. */
+static const char *json_string(const char *p, const char *end, Record *r) {
+    int in_word = r != NULL;
+    int started = 0;
+    while (p < end && *p != '"') {
+        char c = *p++;
+        if (c == '\\' && p < end) {
+            c = *p++;
+            switch (c) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'u': p = (end - p >= 4) ? p + 4 : end; c = '?'; break;
+            }
+        }
+        if (!in_word) continue;
+        if (c == ' ' || c == '\t' || c == '\n') {
+            if (started && !is_time(r)) in_word = 0;
+            started = 0;
+            continue;
+        }
+        if (!started && is_time(r)) r->name_len = 0;
+        started = 1;
+        add_name_byte(r, c);
+    }
+    return p < end ? p + 1 : end;
+}
+
+static const char *json_skip_value(const char *p, const char *end) {
+    if (p < end && *p == '"') return json_string(p + 1, end, NULL);
+    if (p < end && *p == '[') {
+        while (p < end && *p != ']') p++;
+        return p < end ? p + 1 : end;
+    }
+    while (p < end && *p != ',' && *p != '}') p++;
+    return p;
+}
+
+static int parse_json(const char *p, const char *end, Record *r) {
+    if (p >= end || *p != '{') return -1;
+    p++;
+    while (p < end && *p == '"') {
+        const char *key = ++p;
+        while (p < end && *p != '"') p++;
+        size_t klen = (size_t)(p - key);
+        p += 2;
+        if (p > end) return -1;
+
+        if (klen == 3 && memcmp(key, "cmd", 3) == 0 && p < end && *p == '"') {
+            p = json_string(p + 1, end, r);
+        } else if (klen == 6 && memcmp(key, "status", 6) == 0) {
+            r->status = (int)strtol(p, NULL, 10);
+            r->has_status = 1;
+            p = json_skip_value(p, end);
+        } else if (klen == 4 && memcmp(key, "wall", 4) == 0) {
+            r->wall = strtod(p, NULL);
+            r->has_wall = 1;
+            p = json_skip_value(p, end);
+        } else {
+            p = json_skip_value(p, end);
+        }
+        if (p < end && *p == ',') p++;
+    }
+    return r->has_status ? 0 : -1;
+}
+
+static const char *find_field(const char *p, const char *end, const char *key, size_t klen) {
+    while (end - p > (long)klen) {
+        const char *q = (const char *)memchr(p, key[0], (size_t)(end - p));
+        if (!q || end - q < (long)klen) return NULL;
+        if (memcmp(q, key, klen) == 0) return q + klen;
+        p = q + 1;
+    }
+    return NULL;
+}
+
+static int parse_text(const char *p, const char *end, Record *r) {
+    const char *cmd = find_field(p, end, " cmd=\"", 6);
+    if (!cmd) return -1;
+    while (cmd < end && *cmd != ' ' && *cmd != '"') add_name_byte(r, *cmd++);
+    while (is_time(r) && cmd < end && *cmd == ' ') {
+        const char *next = cmd;
+        while (next < end && *next == ' ') next++;
+        if (next == end || *next == '"') break;
+        r->name_len = 0;
+        cmd = next;
+        while (cmd < end && *cmd != ' ' && *cmd != '"') add_name_byte(r, *cmd++);
+    }
+
+    const char *st = find_field(cmd, end, "\" status=", 9);
+    if (!st) return -1;
+    r->status = (int)strtol(st, NULL, 10);
+    r->has_status = 1;
+
+    const char *wall = find_field(st, end, " wall=", 6);
+    if (wall) {
+        r->wall = strtod(wall, NULL);
+        r->has_wall = 1;
+    }
+    return 0;
+}
+
+static int add_wall(Stat *s, double wall) {
+    if (s->nwalls == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 16;
+        double *w = (double *)realloc(s->walls, sizeof(double) * cap);
+        if (!w) return -1;
+        s->walls = w;
+        s->cap = cap;
+    }
+    s->walls[s->nwalls++] = wall;
+    return 0;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_count(const void *a, const void *b) {
+    const Stat *x = *(const Stat *const *)a;
+    const Stat *y = *(const Stat *const *)b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+static double percentile(const Stat *s, double pct) {
+    size_t rank = (size_t)(pct / 100.0 * (double)s->nwalls + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > s->nwalls) rank = s->nwalls;
+    return s->walls[rank - 1] * 1000.0;
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "myshell.log";
+    if (argc > 2 || (argc > 1 && argv[1][0] == '-' && argv[1][1])) {
+        fprintf(stderr, "usage: myshell-logstat [logfile]\n");
+        return 2;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror(path);
+        close(fd);
+        return 1;
+    }
+
+    const char *data = NULL;
+    size_t size = (size_t)st.st_size;
+    if (size > 0) {
+        data = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror("mmap");
+            close(fd);
+            return 1;
+        }
+        madvise((void *)data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    Table t;
+    memset(&t, 0, sizeof(t));
+    unsigned long records = 0;
+    unsigned long skipped = 0;
+
+    const char *p = data;
+    const char *end = data + size;
+    while (p < end) {
+        const char *nl = (const char *)memchr(p, '\n', (size_t)(end - p));
+        const char *eol = nl ? nl : end;
+
+        Record r;
+        r.name_len = 0;
+        r.has_status = 0;
+        r.has_wall = 0;
+        int rc = (*p == '{') ? parse_json(p, eol, &r) : parse_text(p, eol, &r);
+
+        Stat *s = NULL;
+        if (rc == 0) s = table_get(&t, r.name, r.name_len);
+        if (s) {
+            records++;
+            s->count++;
+            if (r.status != 0) s->failures++;
+            if (r.has_wall) add_wall(s, r.wall);
+        } else {
+            skipped++;
+        }
+        p = eol + 1;
+    }
+
+    Stat **order = (Stat **)malloc(sizeof(Stat *) * (t.count ? t.count : 1));
+    if (!order) {
+        fprintf(stderr, "myshell-logstat: out of memory\n");
+        return 1;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < t.cap; i++) {
+        if (t.slots[i].name) order[n++] = &t.slots[i];
+    }
+    qsort(order, n, sizeof(Stat *), cmp_count);
+
+    printf("%-24s %10s %9s %7s %10s %10s %10s %10s\n",
+           "command", "count", "failures", "fail%", "p50_ms", "p90_ms", "p99_ms", "max_ms");
+    for (size_t i = 0; i < n; i++) {
+        Stat *s = order[i];
+        printf("%-24s %10lu %9lu %6.2f%%", s->name[0] ? s->name : "(empty)", s->count, s->failures,
+               100.0 * (double)s->failures / (double)s->count);
+        if (s->nwalls) {
+            qsort(s->walls, s->nwalls, sizeof(double), cmp_double);
+            printf(" %10.3f %10.3f %10.3f %10.3f\n", percentile(s, 50), percentile(s, 90),
+                   percentile(s, 99), s->walls[s->nwalls - 1] * 1000.0);
+        } else {
+            printf(" %10s %10s %10s %10s\n", "-", "-", "-", "-");
+        }
+    }
+    printf("%lu records, %zu commands", records, n);
+    if (skipped) printf(", %lu lines skipped", skipped);
+    printf("\n");
+
+    for (size_t i = 0; i < t.cap; i++) {
+        free(t.slots[i].name);
+        free(t.slots[i].walls);
+    }
+    free(t.slots);
+    free(order);
+    if (data) munmap((void *)data, size);
+    return 0;
+}
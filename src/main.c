@@ -1,92 +1,247 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
-#include <errno.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <sys/epoll.h>
 
 #include "parse.h"
 #include "execute.h"
 #include "builtin.h"
 #include "signals.h"
 #include "logger.h"
-#include "jobs.h"
+#include "shell.h"
+#include "input.h"
+#include "batch.h"
+#include "vars.h"
+#include "history.h"
+#include "lineedit.h"
+#include <limits.h>
+
+extern char **environ;
+
+typedef struct Loop {
+    Shell *sh;
+    int epoll_fd;
+} Loop;
+
+static int loop_init(Loop *loop, Shell *sh, int input_fd) {
+    loop->sh = sh;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) return -1;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = input_fd;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, input_fd, &ev) < 0) goto fail;
+    ev.data.fd = sh->reap_fd;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, sh->reap_fd, &ev) < 0) goto fail;
+    return 0;
 
-static void handle_reaped(int reap_fd, Jobs *jobs, int log_fd) {
-    Reaped buf[32];
+fail:
+    close(loop->epoll_fd);
+    loop->epoll_fd = -1;
+    return -1;
+}
+
+static int loop_wait_input(void *ctx, int fd) {
+    Loop *loop = (Loop *)ctx;
     for (;;) {
-        ssize_t n = signals_read_reaped(reap_fd, buf, 32);
+        struct epoll_event ev[2];
+        int n = epoll_wait(loop->epoll_fd, ev, 2, -1);
         if (n < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
-            return;
+            if (errno == EINTR) continue;
+            return -1;
         }
-        if (n == 0) return;
-
-        size_t count = (size_t)n / sizeof(Reaped);
-        for (size_t i = 0; i < count; i++) {
-            char *cmdline = jobs_take_cmdline(jobs, buf[i].pid);
-            if (cmdline) {
-                logger_log(log_fd, buf[i].pid, cmdline, buf[i].status);
-                free(cmdline);
-            }
+
+        int ready = 0;
+        for (int i = 0; i < n; i++) {
+            if (ev[i].data.fd == fd) ready = 1;
+            else jobs_handle_reaped(&loop->sh->jobs, loop->sh->reap_fd, loop->sh->log_fd);
         }
-        if ((size_t)n < sizeof(buf)) return;
+        if (ready) return 0;
     }
 }
 
-int main(void) {
-    int log_fd = logger_open("myshell.log");
+static void open_history(void) {
+    char buf[PATH_MAX];
+    const char *path = getenv("MYSHELL_HISTFILE");
+    if (!path) {
+        const char *home = getenv("HOME");
+        if (!home) return;
+        snprintf(buf, sizeof(buf), "%s/.myshell_history", home);
+        path = buf;
+    }
+    if (*path && history_open(path) < 0) perror(path);
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: myshell [-j jobs] [-k] [-c command | script]\n");
+}
+
+int main(int argc, char **argv) {
+    const char *command = NULL;
+    int njobs = 0;
+    int ordered = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+c:j:k")) != -1) {
+        switch (opt) {
+        case 'c':
+            command = optarg;
+            break;
+        case 'j':
+            njobs = atoi(optarg);
+            if (njobs <= 0) {
+                usage();
+                return 2;
+            }
+            break;
+        case 'k':
+            ordered = 1;
+            break;
+        default:
+            usage();
+            return 2;
+        }
+    }
+
+    Input in;
+    if (command) {
+        input_open_string(&in, command);
+    } else if (optind < argc) {
+        if (input_open_file(&in, argv[optind]) < 0) {
+            perror(argv[optind]);
+            return 127;
+        }
+    } else if (input_open_fd(&in, STDIN_FILENO) < 0) {
+        perror("input");
+        return 1;
+    }
+
+    Shell sh;
+    sh.log_fd = logger_open("myshell.log");
 
-    Jobs jobs;
-    jobs_init(&jobs);
+    const char *launch = getenv("MYSHELL_LAUNCH");
+    if (launch && execute_set_launch(launch) < 0) {
+        fprintf(stderr, "myshell: MYSHELL_LAUNCH must be fork or spawn\n");
+    }
 
-    int sigchld_pipe[2];
-    if (signals_init(sigchld_pipe) < 0) {
+    const char *pipesize = getenv("MYSHELL_PIPESIZE");
+    int capped;
+    if (pipesize && execute_set_pipesize(pipesize, &capped) < 0) {
+        fprintf(stderr, "myshell: MYSHELL_PIPESIZE must be a size like 1M\n");
+    }
+
+    const char *parse_cache = getenv("MYSHELL_PARSE_CACHE");
+    if (parse_cache && parse_set_cache(parse_cache) < 0) {
+        fprintf(stderr, "myshell: MYSHELL_PARSE_CACHE must be a size like 256K\n");
+    }
+
+    jobs_init(&sh.jobs);
+    sh.status = 0;
+    if (vars_init(environ) < 0) {
+        fprintf(stderr, "myshell: out of memory\n");
+        return 1;
+    }
+
+    sh.reap_fd = signals_init();
+    if (sh.reap_fd < 0) {
         perror("signals_init");
         return 1;
     }
 
-    char line[4096];
+    sh.job_control = 0;
+    sh.tty_fd = STDIN_FILENO;
+    sh.pgid = getpgrp();
+    if (in.interactive && njobs == 0) {
+        open_history();
+        if (signals_job_control(sh.tty_fd, &sh.pgid) == 0) sh.job_control = 1;
+        else perror("job control");
+    }
 
-    while (1) {
-        handle_reaped(sigchld_pipe[0], &jobs, log_fd);
+    Loop loop;
+    loop.epoll_fd = -1;
+    if (njobs == 0 && !in.data && loop_init(&loop, &sh, in.fd) == 0) {
+        in.wait = loop_wait_input;
+        in.wait_ctx = &loop;
+    }
 
-        printf("myshell> ");
-        fflush(stdout);
+    LineEdit ed;
+    int editing = in.interactive && njobs == 0 && lineedit_init(&ed, in.fd) == 0;
+    if (editing) {
+        ed.wait = in.wait;
+        ed.wait_ctx = in.wait_ctx;
+    }
 
-        if (!fgets(line, sizeof(line), stdin)) break;
+    if (njobs > 0) batch_run(&sh, &in, njobs, ordered);
 
-        handle_reaped(sigchld_pipe[0], &jobs, log_fd);
+    Pending pending = { NULL, 0, 0 };
+    while (njobs == 0) {
+        jobs_handle_reaped(&sh.jobs, sh.reap_fd, sh.log_fd);
 
-        const char *err = NULL;
-        Command *cmd = parse_line(line, &err);
-        if (!cmd) {
-            if (err && strcmp(err, "empty") != 0) {
-                fprintf(stderr, "myshell: %s\n", err);
-            }
+        const char *prompt = pending.len ? "> " : "myshell> ";
+        if (in.interactive && !editing) {
+            fputs(prompt, stdout);
+            fflush(stdout);
+        }
+
+        size_t len;
+        const char *line = editing ? lineedit_read(&ed, prompt, &len) : input_next(&in, &len);
+        if (!line) {
+            if (pending.len) fprintf(stderr, "myshell: syntax error: %s\n", PARSE_INCOMPLETE);
+            break;
+        }
+        if (editing && ed.interrupted) {
+            pending.len = 0;
             continue;
         }
 
-        int b = BUILTIN_NONE;
-        if (!cmd->has_pipe) b = builtin_execute(cmd);
+        jobs_handle_reaped(&sh.jobs, sh.reap_fd, sh.log_fd);
 
-        if (b == BUILTIN_EXIT) {
-            free_command(cmd);
-            break;
+        char *expanded = NULL;
+        int event = history_expand(line, len, &expanded);
+        if (event < 0) continue;
+        if (event > 0) {
+            line = expanded;
+            len = strlen(expanded);
+            printf("%s\n", line);
         }
+        history_add(line, len);
 
-        if (b == BUILTIN_NONE) {
-            execute_command(cmd, log_fd, &jobs);
+        const char *err = NULL;
+        Command *cmd = pending_parse(&pending, line, len, &err);
+        free(expanded);
+        if (!cmd) {
+            if (err && strcmp(err, PARSE_INCOMPLETE) != 0 && strcmp(err, "empty") != 0) {
+                fprintf(stderr, "myshell: %s\n", err);
+            }
+            continue;
         }
 
+        int b = execute_line(&sh, cmd);
         free_command(cmd);
+        if (b == BUILTIN_EXIT) break;
+        fflush(stdout);
     }
+    free(pending.buf);
 
-    handle_reaped(sigchld_pipe[0], &jobs, log_fd);
+    jobs_handle_reaped(&sh.jobs, sh.reap_fd, sh.log_fd);
 
-    jobs_cleanup(&jobs);
-    logger_close(log_fd);
-    close(sigchld_pipe[0]);
-    close(sigchld_pipe[1]);
-    return 0;
-}
+    if (getenv("MYSHELL_PARSE_STATS")) {
+        ParseStats st;
+        parse_get_stats(&st);
+        fprintf(stderr, "myshell: parsed %lu lines with %lu mallocs\n", st.lines, st.mallocs);
+        fprintf(stderr, "myshell: parse cache %lu hits %lu misses, %lu entries in %zu bytes\n",
+                st.hits, st.misses, st.cached, st.cache_bytes);
+    }
 
+    jobs_cleanup(&sh.jobs);
+    if (editing) lineedit_free(&ed);
+    history_close();
+    logger_close(sh.log_fd);
+    input_close(&in);
+    if (loop.epoll_fd >= 0) close(loop.epoll_fd);
+    close(sh.reap_fd);
+    return sh.status;
+}
@@ -1,323 +1,799 @@
 #include "parse.h"
+#include "arena.h"
+#include "tokenize.h"
+#include "vars.h"
+#include "size.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
-
-static char *xstrdup(const char *s) {
-    size_t n = strlen(s);
-    char *p = (char *)malloc(n + 1);
-    if (!p) return NULL;
-    memcpy(p, s, n + 1);
-    return p;
-}
 
-static char *trim_copy(const char *line) {
-    while (*line && (*line == ' ' || *line == '\t' || *line == '\n' || *line == '\r')) line++;
-    size_t n = strlen(line);
+#define CACHE_BUCKETS 256
+#define CACHE_DEFAULT_LIMIT (1024 * 1024)
+
+/* Parsed commands are immutable once built, so repeated lines share one tree.
+ * Entries live in their command's arena and hold a reference to it. */
+typedef struct CacheEntry {
+    uint64_t hash;
+    size_t len;
+    size_t bytes;
+    Command *cmd;
+    struct CacheEntry *chain;
+    struct CacheEntry *newer;
+    struct CacheEntry *older;
+} CacheEntry;
+
+static struct {
+    CacheEntry *buckets[CACHE_BUCKETS];
+    CacheEntry *newest;
+    CacheEntry *oldest;
+    size_t bytes;
+    size_t limit;
+} g_cache = { .limit = CACHE_DEFAULT_LIMIT };
+
+static Arena *g_spare = NULL;
+static ParseStats g_stats;
+
+static const char *trim_span(const char *line, size_t n, size_t *out_n) {
+    while (n > 0 && (*line == ' ' || *line == '\t' || *line == '\n' || *line == '\r')) {
+        line++;
+        n--;
+    }
     while (n > 0 && (line[n-1] == ' ' || line[n-1] == '\t' || line[n-1] == '\n' || line[n-1] == '\r')) n--;
-    char *out = (char *)malloc(n + 1);
-    if (!out) return NULL;
-    memcpy(out, line, n);
-    out[n] = '\0';
-    return out;
+    *out_n = n;
+    return line;
 }
 
-static int is_special_char(char c) {
-    return (c == '<' || c == '>' || c == '|' || c == '&');
-}
-
-static int add_token(char ***tokens, int *ntok, int *cap, const char *start, size_t len) {
-    if (*ntok + 1 >= *cap) {
-        int newcap = (*cap == 0) ? 16 : (*cap * 2);
-        char **tmp = (char **)realloc(*tokens, sizeof(char *) * newcap);
-        if (!tmp) return -1;
-        *tokens = tmp;
-        *cap = newcap;
+static uint64_t line_hash(const char *s, size_t n) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
     }
-    char *t = (char *)malloc(len + 1);
-    if (!t) return -1;
-    memcpy(t, start, len);
-    t[len] = '\0';
-    (*tokens)[*ntok] = t;
-    (*ntok)++;
-    (*tokens)[*ntok] = NULL;
-    return 0;
+    return h;
 }
 
-static int tokenize(const char *s, char ***out_tokens, int *out_n) {
-    char **tokens = NULL;
-    int ntok = 0, cap = 0;
-
-    const char *p = s;
-    while (*p) {
-        while (*p && isspace((unsigned char)*p)) p++;
-        if (!*p) break;
-
-        if (*p == '>') {
-            if (*(p+1) == '>') {
-                if (add_token(&tokens, &ntok, &cap, p, 2) < 0) goto fail;
-                p += 2;
-            } else {
-                if (add_token(&tokens, &ntok, &cap, p, 1) < 0) goto fail;
-                p += 1;
-            }
-            continue;
-        }
-
-        if (is_special_char(*p)) {
-            if (add_token(&tokens, &ntok, &cap, p, 1) < 0) goto fail;
-            p += 1;
-            continue;
-        }
-
-        const char *start = p;
-        while (*p && !isspace((unsigned char)*p) && !is_special_char(*p)) p++;
-        if (p > start) {
-            if (add_token(&tokens, &ntok, &cap, start, (size_t)(p - start)) < 0) goto fail;
-        }
+static const char *redir_error(int kind) {
+    switch (kind) {
+    case TOK_IN: return "syntax error near <";
+    case TOK_APPEND: return "syntax error near >>";
+    case TOK_HEREDOC: return "syntax error near <<";
+    case TOK_HERESTR: return "syntax error near <<<";
+    case TOK_DUP_IN: return "syntax error near <&";
+    case TOK_DUP_OUT: return "syntax error near >&";
     }
+    return "syntax error near >";
+}
 
-    *out_tokens = tokens;
-    *out_n = ntok;
-    return 0;
+static int is_redir(int kind) {
+    return kind == TOK_IN || kind == TOK_OUT || kind == TOK_APPEND || kind == TOK_HEREDOC || kind == TOK_HERESTR ||
+           kind == TOK_DUP_IN || kind == TOK_DUP_OUT;
+}
 
-fail:
-    if (tokens) {
-        for (int i = 0; i < ntok; i++) free(tokens[i]);
-        free(tokens);
+static int fd_number(const char *s, size_t len) {
+    if (len == 0 || len > 4) return -1;
+    int fd = 0;
+    for (size_t k = 0; k < len; k++) {
+        if (s[k] < '0' || s[k] > '9') return -1;
+        fd = fd * 10 + (s[k] - '0');
     }
-    return -1;
+    return fd;
 }
 
-static void free_tokens(char **tokens) {
-    if (!tokens) return;
-    for (int i = 0; tokens[i]; i++) free(tokens[i]);
-    free(tokens);
+/* Digits written right against a redirection name its fd: the 2 in 2>err. */
+static int io_number(const char *buf, const Token *w, const Token *op) {
+    if (w->kind != TOK_WORD || !is_redir(op->kind) || w->off + w->len != op->off) return -1;
+    return fd_number(buf + w->off, w->len);
 }
 
-static int argv_push(char ***argv, int *argc, int *cap, const char *s) {
-    if (*argc + 1 >= *cap) {
-        int newcap = (*cap == 0) ? 8 : (*cap * 2);
-        char **tmp = (char **)realloc(*argv, sizeof(char *) * newcap);
-        if (!tmp) return -1;
-        *argv = tmp;
-        *cap = newcap;
+/* Fills r from the operator at tokens[*i] and the words after it. */
+static const char *parse_redir(Arena *a, char *buf, Token *tokens, int *i, int fd, Redir *r) {
+    int kind = tokens[*i].kind;
+    char *target = buf + tokens[++*i].off;
+    int input = kind == TOK_IN || kind == TOK_HEREDOC || kind == TOK_HERESTR || kind == TOK_DUP_IN;
+
+    memset(r, 0, sizeof(*r));
+    r->fd = fd >= 0 ? fd : !input;
+    r->target = target;
+    r->expand = strchr(target, '$') != NULL;
+    switch (kind) {
+    case TOK_IN:
+        r->kind = REDIR_IN;
+        break;
+    case TOK_OUT:
+        r->kind = REDIR_OUT;
+        break;
+    case TOK_APPEND:
+        r->kind = REDIR_APPEND;
+        break;
+    case TOK_DUP_IN:
+    case TOK_DUP_OUT:
+        r->kind = REDIR_DUP;
+        r->expand = 0;
+        r->dup_fd = -1;
+        if (strcmp(target, "-") != 0 && (r->dup_fd = fd_number(target, strlen(target))) < 0) return redir_error(kind);
+        break;
+    case TOK_HERESTR: {
+        size_t len = strlen(target);
+        r->kind = REDIR_DATA;
+        r->target = (char *)arena_alloc(a, len + 2);
+        if (!r->target) return "out of memory";
+        memcpy(r->target, target, len);
+        memcpy(r->target + len, "\n", 2);
+        break;
     }
-    (*argv)[*argc] = xstrdup(s);
-    if (!(*argv)[*argc]) return -1;
-    (*argc)++;
-    (*argv)[*argc] = NULL;
-    return 0;
+    case TOK_HEREDOC: {
+        const Token *body = &tokens[++*i];
+        r->kind = REDIR_DATA;
+        r->target = arena_strndup(a, buf + body->off, body->len);
+        if (!r->target) return "out of memory";
+        /* A quoted delimiter keeps the body literal. */
+        r->expand = target[0] != '\'' && target[0] != '"' && strchr(r->target, '$') != NULL;
+        break;
+    }
+    }
+    return NULL;
 }
 
-static Command *parse_segment(char **tokens, int start, int end, const char **err_msg) {
-    Command *cmd = (Command *)calloc(1, sizeof(Command));
+static Command *parse_segment(Arena *a, char *buf, Token *tokens, int start, int end, const char **err_msg) {
+    Command *cmd = (Command *)arena_alloc(a, sizeof(Command));
     if (!cmd) {
         *err_msg = "out of memory";
         return NULL;
     }
+    memset(cmd, 0, sizeof(*cmd));
 
-    char **argv = NULL;
-    int argc = 0, cap = 0;
-
+    int words = 0;
+    int assigns = 0;
+    int nredirs = 0;
+    int general = 0;
     for (int i = start; i < end; i++) {
-        char *t = tokens[i];
-
-        if (strcmp(t, "<") == 0) {
-            if (i + 1 >= end) {
-                *err_msg = "syntax error near <";
-                goto fail;
-            }
-            free(cmd->in_file);
-            cmd->in_file = xstrdup(tokens[i+1]);
-            if (!cmd->in_file) { *err_msg = "out of memory"; goto fail; }
-            i++;
+        if (i + 1 < end && io_number(buf, &tokens[i], &tokens[i + 1]) >= 0) {
+            general = 1;
             continue;
         }
-
-        if (strcmp(t, ">") == 0) {
-            if (i + 1 >= end) {
-                *err_msg = "syntax error near >";
-                goto fail;
+        int kind = tokens[i].kind;
+        if (kind != TOK_WORD) {
+            if (i + 1 >= end || tokens[i + 1].kind != TOK_WORD) {
+                *err_msg = redir_error(kind);
+                return NULL;
             }
-            free(cmd->out_file);
-            cmd->out_file = xstrdup(tokens[i+1]);
-            if (!cmd->out_file) { *err_msg = "out of memory"; goto fail; }
-            cmd->out_append = 0;
-            i++;
-            continue;
-        }
-
-        if (strcmp(t, ">>") == 0) {
-            if (i + 1 >= end) {
-                *err_msg = "syntax error near >>";
-                goto fail;
+            if (kind == TOK_HEREDOC) {
+                if (i + 2 >= end || tokens[i + 2].kind != TOK_BODY) {
+                    *err_msg = PARSE_INCOMPLETE;
+                    return NULL;
+                }
+                if (memchr(buf + tokens[i + 2].off, '$', tokens[i + 2].len)) cmd->expand = 1;
+                i++;
             }
-            free(cmd->out_file);
-            cmd->out_file = xstrdup(tokens[i+1]);
-            if (!cmd->out_file) { *err_msg = "out of memory"; goto fail; }
-            cmd->out_append = 1;
+            if (strchr(buf + tokens[i + 1].off, '$')) cmd->expand = 1;
+            if (kind != TOK_IN && kind != TOK_OUT && kind != TOK_APPEND) general = 1;
+            nredirs++;
             i++;
             continue;
         }
-
-        if (argv_push(&argv, &argc, &cap, t) < 0) {
-            *err_msg = "out of memory";
-            goto fail;
-        }
+        const char *w = buf + tokens[i].off;
+        const char *eq = strchr(w, '=');
+        if (words == assigns && eq && vars_valid_name(w, (size_t)(eq - w))) assigns++;
+        if (strchr(w, '$')) cmd->expand = 1;
+        words++;
     }
 
-    if (argc == 0) {
+    if (words == 0) {
         *err_msg = "empty command";
-        goto fail;
+        return NULL;
+    }
+
+    cmd->argv = (char **)arena_alloc(a, sizeof(char *) * (size_t)(words - assigns + 1));
+    cmd->assign = (char **)arena_alloc(a, sizeof(char *) * (size_t)(assigns + 1));
+    if (general) cmd->redirs = (Redir *)arena_alloc(a, sizeof(Redir) * (size_t)nredirs);
+    if (!cmd->argv || !cmd->assign || (general && !cmd->redirs)) {
+        *err_msg = "out of memory";
+        return NULL;
     }
 
-    cmd->argv = argv;
-    cmd->argc = argc;
+    for (int i = start; i < end; i++) {
+        int fd = -1;
+        if (i + 1 < end && (fd = io_number(buf, &tokens[i], &tokens[i + 1])) >= 0) i++;
+        if (general && tokens[i].kind != TOK_WORD) {
+            if ((*err_msg = parse_redir(a, buf, tokens, &i, fd, &cmd->redirs[cmd->nredirs++])) != NULL) return NULL;
+            continue;
+        }
+        switch (tokens[i].kind) {
+        case TOK_IN:
+            cmd->in_file = buf + tokens[++i].off;
+            break;
+        case TOK_OUT:
+            cmd->out_file = buf + tokens[++i].off;
+            cmd->out_append = 0;
+            break;
+        case TOK_APPEND:
+            cmd->out_file = buf + tokens[++i].off;
+            cmd->out_append = 1;
+            break;
+        default:
+            if (cmd->nassign < assigns) cmd->assign[cmd->nassign++] = buf + tokens[i].off;
+            else cmd->argv[cmd->argc++] = buf + tokens[i].off;
+            break;
+        }
+    }
+    cmd->argv[cmd->argc] = NULL;
+
     return cmd;
+}
 
-fail:
-    if (argv) {
-        for (int i = 0; i < argc; i++) free(argv[i]);
-        free(argv);
+typedef struct Parser {
+    Arena *a;
+    char *buf;
+    const char *text;
+    Token *t;
+    int n;
+    int i;
+    const char *err;
+} Parser;
+
+static char g_errbuf[80];
+
+static const char *token_text(const Parser *p, int i) {
+    switch (p->t[i].kind) {
+    case TOK_IN: return "<";
+    case TOK_OUT: return ">";
+    case TOK_APPEND: return ">>";
+    case TOK_PIPE: return "|";
+    case TOK_AMP: return "&";
+    case TOK_AND: return "&&";
+    case TOK_OR: return "||";
+    case TOK_SEMI: return ";";
+    case TOK_NL: return "newline";
+    case TOK_HEREDOC: return "<<";
+    case TOK_HERESTR: return "<<<";
+    case TOK_DUP_IN: return "<&";
+    case TOK_DUP_OUT: return ">&";
+    case TOK_BODY: return "here-document";
     }
-    free(cmd->in_file);
-    free(cmd->out_file);
-    free(cmd);
+    return p->buf + p->t[i].off;
+}
+
+/* Fails at the current token, or asks for more input when there is none. */
+static Command *syntax_error(Parser *p) {
+    if (p->i >= p->n) {
+        p->err = PARSE_INCOMPLETE;
+        return NULL;
+    }
+    snprintf(g_errbuf, sizeof(g_errbuf), "syntax error near %s", token_text(p, p->i));
+    p->err = g_errbuf;
     return NULL;
 }
 
-Command *parse_line(const char *line, const char **err_msg) {
-    *err_msg = NULL;
+static int at_kind(const Parser *p, int kind) {
+    return p->i < p->n && p->t[p->i].kind == kind;
+}
 
-    char *trimmed = trim_copy(line);
-    if (!trimmed) {
-        *err_msg = "out of memory";
-        return NULL;
+static int at_word(const Parser *p, const char *word) {
+    return at_kind(p, TOK_WORD) && strcmp(p->buf + p->t[p->i].off, word) == 0;
+}
+
+static int at_terminator(const Parser *p) {
+    static const char *words[] = { "then", "else", "elif", "fi", "do", "done" };
+    for (size_t k = 0; k < sizeof(words) / sizeof(words[0]); k++) {
+        if (at_word(p, words[k])) return 1;
     }
-    if (trimmed[0] == '\0') {
-        free(trimmed);
-        *err_msg = "empty";
-        return NULL;
+    return 0;
+}
+
+static int expect(Parser *p, const char *word) {
+    if (!at_word(p, word)) {
+        syntax_error(p);
+        return -1;
     }
+    p->i++;
+    return 0;
+}
 
-    char **tokens = NULL;
-    int ntok = 0;
-    if (tokenize(trimmed, &tokens, &ntok) < 0) {
-        free(trimmed);
-        *err_msg = "tokenize failed";
+static void skip_newlines(Parser *p) {
+    while (at_kind(p, TOK_NL)) p->i++;
+}
+
+static char *span(Parser *p, int start, int end) {
+    size_t from = p->t[start].off;
+    size_t to = p->t[end - 1].off + p->t[end - 1].len;
+    return arena_strndup(p->a, p->text + from, to - from);
+}
+
+static Command *node(Parser *p, int kind, Command *left, Command *right) {
+    Command *c = (Command *)arena_alloc(p->a, sizeof(Command));
+    if (!c) {
+        p->err = "out of memory";
         return NULL;
     }
+    memset(c, 0, sizeof(*c));
+    c->kind = kind;
+    c->left = left;
+    c->right = right;
+    return c;
+}
 
-    if (ntok == 0) {
-        free_tokens(tokens);
-        free(trimmed);
-        *err_msg = "empty";
+static Command *parse_list(Parser *p);
+
+static Command *parse_body(Parser *p) {
+    Command *c = parse_list(p);
+    if (!c && !p->err) syntax_error(p);
+    return c;
+}
+
+/* After "if" or "elif"; elif chains nest in alt and share the final fi. */
+static Command *parse_if(Parser *p) {
+    Command *c = node(p, CMD_IF, NULL, NULL);
+    if (!c || !(c->left = parse_body(p)) || expect(p, "then") < 0) return NULL;
+    if (!(c->right = parse_body(p))) return NULL;
+
+    if (at_word(p, "elif")) {
+        p->i++;
+        c->alt = parse_if(p);
+        return c->alt ? c : NULL;
+    }
+    if (at_word(p, "else")) {
+        p->i++;
+        if (!(c->alt = parse_body(p))) return NULL;
+    }
+    return expect(p, "fi") < 0 ? NULL : c;
+}
+
+static Command *parse_while(Parser *p) {
+    Command *c = node(p, at_word(p, "while") ? CMD_WHILE : CMD_UNTIL, NULL, NULL);
+    if (!c) return NULL;
+    p->i++;
+    if (!(c->left = parse_body(p)) || expect(p, "do") < 0) return NULL;
+    if (!(c->right = parse_body(p))) return NULL;
+    return expect(p, "done") < 0 ? NULL : c;
+}
+
+static Command *parse_for(Parser *p) {
+    Command *c = node(p, CMD_FOR, NULL, NULL);
+    if (!c) return NULL;
+    p->i++;
+    if (!at_kind(p, TOK_WORD) || !vars_valid_name(p->buf + p->t[p->i].off, p->t[p->i].len)) return syntax_error(p);
+    c->var = p->buf + p->t[p->i++].off;
+
+    skip_newlines(p);
+    if (expect(p, "in") < 0) return NULL;
+    int start = p->i;
+    while (at_kind(p, TOK_WORD)) p->i++;
+
+    c->argc = p->i - start;
+    c->argv = (char **)arena_alloc(p->a, sizeof(char *) * (size_t)(c->argc + 1));
+    if (!c->argv) {
+        p->err = "out of memory";
         return NULL;
     }
+    for (int k = 0; k < c->argc; k++) {
+        c->argv[k] = p->buf + p->t[start + k].off;
+        if (strchr(c->argv[k], '$')) c->expand = 1;
+    }
+    c->argv[c->argc] = NULL;
 
-    int background = 0;
-    if (strcmp(tokens[ntok - 1], "&") == 0) {
-        background = 1;
-        free(tokens[ntok - 1]);
-        tokens[ntok - 1] = NULL;
-        ntok--;
-        if (ntok == 0) {
-            free_tokens(tokens);
-            free(trimmed);
-            *err_msg = "syntax error near &";
+    if (at_kind(p, TOK_SEMI)) p->i++;
+    skip_newlines(p);
+    if (expect(p, "do") < 0 || !(c->right = parse_body(p))) return NULL;
+    return expect(p, "done") < 0 ? NULL : c;
+}
+
+static int ends_pipeline(int kind) {
+    return kind == TOK_AMP || kind == TOK_AND || kind == TOK_OR || kind == TOK_SEMI || kind == TOK_NL;
+}
+
+static Command *parse_pipeline(Parser *p) {
+    if (at_word(p, "if")) {
+        p->i++;
+        return parse_if(p);
+    }
+    if (at_word(p, "while") || at_word(p, "until")) return parse_while(p);
+    if (at_word(p, "for")) return parse_for(p);
+
+    int start = p->i;
+    int timed = 0;
+    if (at_word(p, "time") && p->i + 1 < p->n && p->t[p->i + 1].kind == TOK_WORD) {
+        timed = 1;
+        p->i++;
+    }
+
+    Command *cmd = NULL;
+    Command *tail = NULL;
+    for (;;) {
+        int seg_start = p->i;
+        while (p->i < p->n && p->t[p->i].kind != TOK_PIPE && !ends_pipeline(p->t[p->i].kind)) p->i++;
+
+        if (p->i == seg_start) {
+            if (!tail) return syntax_error(p);
+            p->err = "syntax error near |";
             return NULL;
         }
-    } else {
-        for (int i = 0; i < ntok; i++) {
-            if (strcmp(tokens[i], "&") == 0) {
-                free_tokens(tokens);
-                free(trimmed);
-                *err_msg = "& must be at end of line";
-                return NULL;
-            }
+
+        Command *stage = parse_segment(p->a, p->buf, p->t, seg_start, p->i, &p->err);
+        if (!stage) return NULL;
+        if (tail) {
+            tail->has_pipe = 1;
+            tail->pipe_cmd = stage;
+        } else {
+            cmd = stage;
+        }
+        tail = stage;
+
+        if (!at_kind(p, TOK_PIPE)) break;
+        p->i++;
+    }
+
+    for (Command *c = cmd; cmd->has_pipe && c; c = c->pipe_cmd) {
+        if (c->argc == 0) {
+            p->err = "empty command";
+            return NULL;
         }
     }
 
-    int pipe_pos = -1;
-    for (int i = 0; i < ntok; i++) {
-        if (strcmp(tokens[i], "|") == 0) {
-            if (pipe_pos != -1) {
-                free_tokens(tokens);
-                free(trimmed);
-                *err_msg = "only one pipe supported";
+    cmd->timed = timed;
+    cmd->rawline = span(p, start, p->i);
+    if (!cmd->rawline) p->err = "out of memory";
+    return cmd->rawline ? cmd : NULL;
+}
+
+static Command *parse_and_or(Parser *p) {
+    Command *left = parse_pipeline(p);
+    while (left && (at_kind(p, TOK_AND) || at_kind(p, TOK_OR))) {
+        int kind = at_kind(p, TOK_AND) ? CMD_AND : CMD_OR;
+        p->i++;
+        skip_newlines(p);
+        Command *right = parse_pipeline(p);
+        left = right ? node(p, kind, left, right) : NULL;
+    }
+    return left;
+}
+
+/* Returns NULL without an error for an empty list. Stops before a keyword
+ * that closes the enclosing block. */
+static Command *parse_list(Parser *p) {
+    Command *list = NULL;
+    for (;;) {
+        skip_newlines(p);
+        if (p->i >= p->n || at_terminator(p)) break;
+
+        int start = p->i;
+        Command *item = parse_and_or(p);
+        if (!item) return NULL;
+
+        if (at_kind(p, TOK_AMP)) {
+            if (item->kind != CMD_PIPELINE) return syntax_error(p);
+            p->i++;
+            item->background = 1;
+            if (!(item->rawline = span(p, start, p->i))) {
+                p->err = "out of memory";
                 return NULL;
             }
-            pipe_pos = i;
         }
+
+        if (list && !(item = node(p, CMD_SEQ, list, item))) return NULL;
+        list = item;
+
+        if (at_kind(p, TOK_SEMI) || at_kind(p, TOK_NL)) p->i++;
+        else if (p->t[p->i - 1].kind != TOK_AMP) break;
     }
+    return list;
+}
 
-    Command *cmd = NULL;
+static Arena *arena_get(void) {
+    Arena *a = g_spare;
+    if (a) {
+        g_spare = NULL;
+        return a;
+    }
+    a = (Arena *)malloc(sizeof(Arena));
+    if (!a) return NULL;
+    g_stats.mallocs++;
+    arena_init(a);
+    return a;
+}
 
-    if (pipe_pos == -1) {
-        cmd = parse_segment(tokens, 0, ntok, err_msg);
-        if (!cmd) {
-            free_tokens(tokens);
-            free(trimmed);
-            return NULL;
-        }
-    } else {
-        if (pipe_pos == 0 || pipe_pos == ntok - 1) {
-            free_tokens(tokens);
-            free(trimmed);
-            *err_msg = "syntax error near |";
-            return NULL;
-        }
+static void arena_put(Arena *a) {
+    arena_reset(a);
+    if (!g_spare) {
+        g_spare = a;
+        return;
+    }
+    arena_free(a);
+    free(a);
+}
 
-        Command *left = parse_segment(tokens, 0, pipe_pos, err_msg);
-        if (!left) {
-            free_tokens(tokens);
-            free(trimmed);
-            return NULL;
+static Command *parse_fail(Arena *a, unsigned long before, const char **err_msg, const char *msg) {
+    if (msg) *err_msg = msg;
+    g_stats.mallocs += a->mallocs - before;
+    arena_put(a);
+    return NULL;
+}
+
+static void lru_unlink(CacheEntry *e) {
+    if (e->newer) e->newer->older = e->older;
+    else g_cache.newest = e->older;
+    if (e->older) e->older->newer = e->newer;
+    else g_cache.oldest = e->newer;
+    e->newer = e->older = NULL;
+}
+
+static void lru_push(CacheEntry *e) {
+    e->older = g_cache.newest;
+    e->newer = NULL;
+    if (g_cache.newest) g_cache.newest->newer = e;
+    else g_cache.oldest = e;
+    g_cache.newest = e;
+}
+
+static void cache_evict(CacheEntry *e) {
+    CacheEntry **pp = &g_cache.buckets[e->hash & (CACHE_BUCKETS - 1)];
+    while (*pp != e) pp = &(*pp)->chain;
+    *pp = e->chain;
+    lru_unlink(e);
+    g_cache.bytes -= e->bytes;
+    g_stats.cached--;
+    free_command(e->cmd);
+}
+
+static void cache_trim(size_t limit) {
+    while (g_cache.oldest && g_cache.bytes > limit) cache_evict(g_cache.oldest);
+}
+
+static Command *cache_find(uint64_t hash, const char *line, size_t n) {
+    for (CacheEntry *e = g_cache.buckets[hash & (CACHE_BUCKETS - 1)]; e; e = e->chain) {
+        if (e->hash != hash || e->len != n || memcmp(e->cmd->rawline, line, n) != 0) continue;
+        if (g_cache.newest != e) {
+            lru_unlink(e);
+            lru_push(e);
         }
-        Command *right = parse_segment(tokens, pipe_pos + 1, ntok, err_msg);
-        if (!right) {
-            free_command(left);
-            free_tokens(tokens);
-            free(trimmed);
+        return e->cmd;
+    }
+    return NULL;
+}
+
+static void cache_insert(CacheEntry *e, Command *cmd, uint64_t hash, size_t n) {
+    e->hash = hash;
+    e->len = n;
+    e->bytes = arena_size(cmd->arena);
+    e->cmd = cmd;
+    if (e->bytes > g_cache.limit) return;
+
+    cache_trim(g_cache.limit - e->bytes);
+    CacheEntry **bucket = &g_cache.buckets[hash & (CACHE_BUCKETS - 1)];
+    e->chain = *bucket;
+    *bucket = e;
+    lru_push(e);
+    g_cache.bytes += e->bytes;
+    g_stats.cached++;
+    cmd->refs++;
+}
+
+static int pending_add(Pending *p, const char *line, size_t len) {
+    if (p->len + len + 2 > p->cap) {
+        size_t cap = p->cap ? p->cap : 256;
+        while (cap < p->len + len + 2) cap *= 2;
+        char *buf = (char *)realloc(p->buf, cap);
+        if (!buf) return -1;
+        p->buf = buf;
+        p->cap = cap;
+    }
+    memcpy(p->buf + p->len, line, len);
+    p->len += len;
+    p->buf[p->len++] = '\n';
+    p->buf[p->len] = '\0';
+    return 0;
+}
+
+/* Parses line, after the lines still pending if a block or here-document is
+ * open. On PARSE_INCOMPLETE the line is kept for the next call. */
+Command *pending_parse(Pending *p, const char *line, size_t len, const char **err_msg) {
+    if (p->len) {
+        if (pending_add(p, line, len) < 0) {
+            p->len = 0;
+            *err_msg = "out of memory";
             return NULL;
         }
-        left->has_pipe = 1;
-        left->pipe_cmd = right;
-        cmd = left;
+        line = p->buf;
+        len = p->len;
     }
+    Command *cmd = parse_line_n(line, len, err_msg);
+    if (!cmd && *err_msg && strcmp(*err_msg, PARSE_INCOMPLETE) == 0) {
+        if (p->len || pending_add(p, line, len) == 0) return NULL;
+        *err_msg = "out of memory";
+    }
+    p->len = 0;
+    return cmd;
+}
+
+Command *parse_line(const char *line, const char **err_msg) {
+    return parse_line_n(line, strlen(line), err_msg);
+}
+
+Command *parse_line_n(const char *line, size_t len, const char **err_msg) {
+    *err_msg = NULL;
+    g_stats.lines++;
 
-    cmd->background = background;
-    cmd->rawline = xstrdup(trimmed);
+    size_t n;
+    const char *span = trim_span(line, len, &n);
+    if (n == 0) {
+        *err_msg = "empty";
+        return NULL;
+    }
 
-    free_tokens(tokens);
-    free(trimmed);
+    uint64_t hash = 0;
+    if (g_cache.limit > 0) {
+        hash = line_hash(span, n);
+        Command *hit = cache_find(hash, span, n);
+        if (hit) {
+            g_stats.hits++;
+            hit->refs++;
+            return hit;
+        }
+        g_stats.misses++;
+    }
 
-    if (!cmd->rawline) {
-        free_command(cmd);
+    Arena *a = arena_get();
+    if (!a) {
         *err_msg = "out of memory";
         return NULL;
     }
+    unsigned long before = a->mallocs;
+
+    CacheEntry *entry = NULL;
+    if (g_cache.limit > 0) {
+        entry = (CacheEntry *)arena_alloc(a, sizeof(CacheEntry));
+        if (!entry) return parse_fail(a, before, err_msg, "out of memory");
+    }
+
+    char *trimmed = arena_strndup(a, span, n);
+    char *buf = arena_strndup(a, span, n);
+    if (!trimmed || !buf) return parse_fail(a, before, err_msg, "out of memory");
+
+    Token *tokens = NULL;
+    int ntok = 0;
+    if (tokenize_slices(a, buf, n, &tokens, &ntok) < 0) return parse_fail(a, before, err_msg, "tokenize failed");
+
+    if (ntok == 0) return parse_fail(a, before, err_msg, "empty");
+
+    for (int i = 0; i < ntok; i++) {
+        if (tokens[i].kind == TOK_WORD) buf[tokens[i].off + tokens[i].len] = '\0';
+    }
+
+    Parser p = { a, buf, trimmed, tokens, ntok, 0, NULL };
+    Command *cmd = parse_list(&p);
+    if (cmd && p.i < p.n) cmd = syntax_error(&p);
+    if (!cmd) return parse_fail(a, before, err_msg, p.err ? p.err : "empty");
 
+    cmd->rawline = trimmed;
+    cmd->arena = a;
+    cmd->refs = 1;
+    g_stats.mallocs += a->mallocs - before;
+
+    if (entry) cache_insert(entry, cmd, hash, n);
     return cmd;
 }
 
 void free_command(Command *cmd) {
-    if (!cmd) return;
+    if (!cmd || !cmd->arena) return;
+    if (--cmd->refs > 0) return;
+    arena_put(cmd->arena);
+}
 
-    if (cmd->has_pipe && cmd->pipe_cmd) {
-        free_command(cmd->pipe_cmd);
-        cmd->pipe_cmd = NULL;
-    }
+void parse_get_stats(ParseStats *st) {
+    *st = g_stats;
+    st->cache_bytes = g_cache.bytes;
+}
+
+int parse_set_cache(const char *size) {
+    long long limit = size_parse(size);
+    if (limit < 0) return -1;
+    g_cache.limit = (size_t)limit;
+    cache_trim(g_cache.limit);
+    return 0;
+}
+
+/* Writes the expansion of word to out, or only measures it when out is NULL.
+ * Handles $NAME, ${NAME}, $? and $$; any other $ is literal. */
+static size_t expand_into(char *out, const char *w, int status) {
+    size_t n = 0;
+    char num[24];
+    while (*w) {
+        const char *val = NULL;
+        size_t vlen = 0;
+        if (w[0] == '$' && (w[1] == '?' || w[1] == '$')) {
+            vlen = (size_t)snprintf(num, sizeof(num), "%d", w[1] == '?' ? status : (int)getpid());
+            val = num;
+            w += 2;
+        } else if (w[0] == '$' && w[1] == '{') {
+            const char *end = strchr(w + 2, '}');
+            if (!end || !vars_valid_name(w + 2, (size_t)(end - w - 2))) goto literal;
+            val = vars_get_n(w + 2, (size_t)(end - w - 2));
+            w = end + 1;
+        } else if (w[0] == '$' && vars_valid_name(w + 1, 1)) {
+            size_t len = 1;
+            while (w[len + 1] == '_' || isalnum((unsigned char)w[len + 1])) len++;
+            val = vars_get_n(w + 1, len);
+            w += len + 1;
+        } else {
+            goto literal;
+        }
 
-    if (cmd->argv) {
-        for (int i = 0; i < cmd->argc; i++) free(cmd->argv[i]);
-        free(cmd->argv);
+        if (val && !vlen) vlen = strlen(val);
+        if (out && vlen) memcpy(out + n, val, vlen);
+        n += vlen;
+        continue;
+
+    literal:
+        if (out) out[n] = *w;
+        n++;
+        w++;
     }
+    if (out) out[n] = '\0';
+    return n;
+}
+
+char *parse_expand_word(Arena *a, const char *word, int status) {
+    if (!strchr(word, '$')) return (char *)word;
+    char *out = (char *)arena_alloc(a, expand_into(NULL, word, status) + 1);
+    if (out) expand_into(out, word, status);
+    return out;
+}
 
-    free(cmd->in_file);
-    free(cmd->out_file);
-    free(cmd->rawline);
-    free(cmd);
+static int expand_words(Arena *a, char **words, int n, char ***out, int *out_n, int drop_empty, int status) {
+    char **v = (char **)arena_alloc(a, sizeof(char *) * (size_t)(n + 1));
+    if (!v) return -1;
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        char *w = parse_expand_word(a, words[i], status);
+        if (!w) return -1;
+        if (drop_empty && !*w && w != words[i]) continue;
+        v[k++] = w;
+    }
+    v[k] = NULL;
+    *out = v;
+    *out_n = k;
+    return 0;
 }
 
+/* Shared trees are never expanded in place: a pipeline that needs it gets a
+ * copy in a, rebuilt on every run. Words that expand to nothing are dropped,
+ * and there is no field splitting. */
+Command *parse_expand(Arena *a, Command *cmd, int status) {
+    int needed = 0;
+    for (Command *c = cmd; c; c = c->has_pipe ? c->pipe_cmd : NULL) needed |= c->expand || c->nassign;
+    if (!needed) return cmd;
+
+    Command *head = NULL;
+    Command *tail = NULL;
+    for (Command *c = cmd; c; c = c->has_pipe ? c->pipe_cmd : NULL) {
+        Command *x = (Command *)arena_alloc(a, sizeof(Command));
+        if (!x) return NULL;
+        *x = *c;
+        x->expand = 0;
+        x->arena = NULL;
+        if (c->expand) {
+            if (expand_words(a, c->argv, c->argc, &x->argv, &x->argc, 1, status) < 0) return NULL;
+            if (c->in_file && !(x->in_file = parse_expand_word(a, c->in_file, status))) return NULL;
+            if (c->out_file && !(x->out_file = parse_expand_word(a, c->out_file, status))) return NULL;
+            if (c->nredirs) {
+                x->redirs = (Redir *)arena_alloc(a, sizeof(Redir) * (size_t)c->nredirs);
+                if (!x->redirs) return NULL;
+                for (int i = 0; i < c->nredirs; i++) {
+                    x->redirs[i] = c->redirs[i];
+                    if (c->redirs[i].expand && !(x->redirs[i].target = parse_expand_word(a, c->redirs[i].target, status))) {
+                        return NULL;
+                    }
+                }
+            }
+        }
+        if (c->nassign && expand_words(a, c->assign, c->nassign, &x->assign, &x->nassign, 0, status) < 0) return NULL;
+
+        if (tail) tail->pipe_cmd = x;
+        else head = x;
+        tail = x;
+    }
+    return head;
+}
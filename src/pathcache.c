@@ -0,0 +1,454 @@
+#include "pathcache.h"
+#include "vars.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+typedef struct PathEntry {
+    char *name;
+    char *path;
+    unsigned hits;
+} PathEntry;
+
+static PathEntry *g_table = NULL;
+static size_t g_cap = 0;
+static size_t g_count = 0;
+static char *g_path_env = NULL;
+static int g_path_relative = 0;
+
+/* Sorted (name, dir) list of every file in the PATH directories, built on
+ * first use and kept current from inotify events. dir is the position in
+ * PATH, so the first entry for a name is the one exec would pick. When every
+ * directory is absolute and watched, a lookup miss only stats the
+ * directories that actually hold the name. */
+typedef struct IndexEntry {
+    char *name;
+    int dir;
+} IndexEntry;
+
+static struct {
+    IndexEntry *v;
+    size_t n;
+    size_t cap;
+    char **dirs;
+    int *wd;
+    int ndirs;
+    int fd;
+    int built;
+    int complete;
+} g_idx = { .fd = -1 };
+
+static char *xstrdup(const char *s) {
+    size_t n = strlen(s);
+    char *p = (char *)malloc(n + 1);
+    if (!p) return NULL;
+    memcpy(p, s, n + 1);
+    return p;
+}
+
+static size_t hash_name(const char *s) {
+    size_t h = 1469598103934665603ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static PathEntry *find_slot(PathEntry *table, size_t cap, const char *name) {
+    size_t i = hash_name(name) & (cap - 1);
+    while (table[i].name && strcmp(table[i].name, name) != 0) i = (i + 1) & (cap - 1);
+    return &table[i];
+}
+
+static int grow(void) {
+    size_t newcap = g_cap ? g_cap * 2 : 64;
+    PathEntry *t = (PathEntry *)calloc(newcap, sizeof(PathEntry));
+    if (!t) return -1;
+    for (size_t i = 0; i < g_cap; i++) {
+        if (g_table[i].name) *find_slot(t, newcap, g_table[i].name) = g_table[i];
+    }
+    free(g_table);
+    g_table = t;
+    g_cap = newcap;
+    return 0;
+}
+
+static void index_free(void) {
+    for (size_t i = 0; i < g_idx.n; i++) free(g_idx.v[i].name);
+    for (int d = 0; d < g_idx.ndirs; d++) free(g_idx.dirs[d]);
+    free(g_idx.v);
+    free(g_idx.dirs);
+    free(g_idx.wd);
+    if (g_idx.fd >= 0) close(g_idx.fd);
+    memset(&g_idx, 0, sizeof(g_idx));
+    g_idx.fd = -1;
+}
+
+static void hash_clear(void) {
+    for (size_t i = 0; i < g_cap; i++) {
+        free(g_table[i].name);
+        free(g_table[i].path);
+    }
+    free(g_table);
+    g_table = NULL;
+    g_cap = 0;
+    g_count = 0;
+}
+
+void pathcache_reset(void) {
+    index_free();
+    hash_clear();
+}
+
+/* With PATH unset, commands are searched in the system default path, as
+ * execvp did before the cache, not just the current directory. */
+static const char *default_path(void) {
+    static char *path = NULL;
+    if (!path) {
+        size_t n = confstr(_CS_PATH, NULL, 0);
+        path = n ? (char *)malloc(n) : NULL;
+        if (!path) return "/bin:/usr/bin";
+        confstr(_CS_PATH, path, n);
+    }
+    return path;
+}
+
+static void check_path_env(void) {
+    const char *env = vars_get("PATH");
+    if (!env) env = default_path();
+    if (g_path_env && strcmp(g_path_env, env) == 0) return;
+    pathcache_reset();
+    free(g_path_env);
+    g_path_env = xstrdup(env);
+
+    /* An empty or relative entry makes lookups depend on the current directory. */
+    g_path_relative = 0;
+    for (const char *p = env;; p++) {
+        if (*p != '/') g_path_relative = 1;
+        p = strchr(p, ':');
+        if (!p) break;
+    }
+}
+
+static char *search_path(const char *name, const char *env) {
+    size_t nlen = strlen(name);
+    const char *p = env ? env : "";
+
+    for (;;) {
+        const char *end = strchr(p, ':');
+        size_t dlen = end ? (size_t)(end - p) : strlen(p);
+
+        char *full = (char *)malloc(dlen + nlen + 3);
+        if (!full) return NULL;
+        if (dlen == 0) {
+            memcpy(full, "./", 2);
+            dlen = 2;
+        } else {
+            memcpy(full, p, dlen);
+            full[dlen++] = '/';
+        }
+        memcpy(full + dlen, name, nlen + 1);
+
+        struct stat st;
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) return full;
+        free(full);
+
+        if (!end) return NULL;
+        p = end + 1;
+    }
+}
+
+static int cmp_entry(const void *a, const void *b) {
+    const IndexEntry *x = (const IndexEntry *)a;
+    const IndexEntry *y = (const IndexEntry *)b;
+    int c = strcmp(x->name, y->name);
+    return c ? c : x->dir - y->dir;
+}
+
+/* First entry not ordered before (name, dir). */
+static size_t index_bound(const char *name, int dir) {
+    size_t lo = 0, hi = g_idx.n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(g_idx.v[mid].name, name);
+        if (c < 0 || (c == 0 && g_idx.v[mid].dir < dir)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int index_push(const char *name, int dir) {
+    if (g_idx.n == g_idx.cap) {
+        size_t cap = g_idx.cap ? g_idx.cap * 2 : 1024;
+        IndexEntry *v = (IndexEntry *)realloc(g_idx.v, sizeof(IndexEntry) * cap);
+        if (!v) return -1;
+        g_idx.v = v;
+        g_idx.cap = cap;
+    }
+    char *copy = xstrdup(name);
+    if (!copy) return -1;
+    g_idx.v[g_idx.n].name = copy;
+    g_idx.v[g_idx.n].dir = dir;
+    g_idx.n++;
+    return 0;
+}
+
+static void index_insert(const char *name, int dir) {
+    size_t i = index_bound(name, dir);
+    if (i < g_idx.n && g_idx.v[i].dir == dir && strcmp(g_idx.v[i].name, name) == 0) return;
+    if (index_push(name, dir) < 0) return;
+    IndexEntry e = g_idx.v[g_idx.n - 1];
+    memmove(&g_idx.v[i + 1], &g_idx.v[i], sizeof(IndexEntry) * (g_idx.n - 1 - i));
+    g_idx.v[i] = e;
+}
+
+static void index_remove(const char *name, int dir) {
+    size_t i = index_bound(name, dir);
+    if (i == g_idx.n || g_idx.v[i].dir != dir || strcmp(g_idx.v[i].name, name) != 0) return;
+    free(g_idx.v[i].name);
+    memmove(&g_idx.v[i], &g_idx.v[i + 1], sizeof(IndexEntry) * (g_idx.n - 1 - i));
+    g_idx.n--;
+}
+
+static void index_drop_dir(int dir) {
+    size_t j = 0;
+    for (size_t i = 0; i < g_idx.n; i++) {
+        if (g_idx.v[i].dir == dir) free(g_idx.v[i].name);
+        else g_idx.v[j++] = g_idx.v[i];
+    }
+    g_idx.n = j;
+}
+
+/* Only d_type is looked at, so scanning a big directory on a network mount
+ * costs its getdents calls and no stat per file; exec still checks the mode
+ * of the one file it picks. */
+static void scan_dir(int dir) {
+    DIR *d = opendir(g_idx.dirs[dir]);
+    if (!d) return;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+        if (de->d_type != DT_REG && de->d_type != DT_LNK && de->d_type != DT_UNKNOWN) continue;
+        if (index_push(de->d_name, dir) < 0) break;
+    }
+    closedir(d);
+}
+
+static void index_build(void) {
+    index_free();
+    g_idx.built = 1;
+    g_idx.complete = 1;
+    g_idx.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g_idx.fd < 0) g_idx.complete = 0;
+
+    const char *p = g_path_env ? g_path_env : "";
+    size_t max = 1;
+    for (const char *c = p; *c; c++) max += (*c == ':');
+    g_idx.dirs = (char **)calloc(max, sizeof(char *));
+    g_idx.wd = (int *)calloc(max, sizeof(int));
+    if (!g_idx.dirs || !g_idx.wd) {
+        g_idx.complete = 0;
+        return;
+    }
+
+    for (;;) {
+        const char *end = strchr(p, ':');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == 0 || p[0] != '/') {
+            /* Relative entries follow the cwd and cannot be watched. */
+            g_idx.complete = 0;
+        } else {
+            char *dir = (char *)malloc(len + 1);
+            if (!dir) break;
+            memcpy(dir, p, len);
+            dir[len] = '\0';
+
+            int dup = 0;
+            for (int d = 0; d < g_idx.ndirs && !dup; d++) dup = strcmp(g_idx.dirs[d], dir) == 0;
+            if (dup) {
+                free(dir);
+            } else {
+                int d = g_idx.ndirs++;
+                g_idx.dirs[d] = dir;
+                g_idx.wd[d] = g_idx.fd < 0 ? -1 :
+                    inotify_add_watch(g_idx.fd, dir, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                      IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+                if (g_idx.wd[d] < 0 && access(dir, F_OK) == 0) g_idx.complete = 0;
+                scan_dir(d);
+            }
+        }
+        if (!end) break;
+        p = end + 1;
+    }
+    qsort(g_idx.v, g_idx.n, sizeof(IndexEntry), cmp_entry);
+}
+
+/* Applies whatever changed in the PATH directories since the last call. */
+static void index_refresh(void) {
+    if (!g_idx.built) {
+        index_build();
+        return;
+    }
+    if (g_idx.fd < 0) return;
+
+    char buf[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t r;
+    while ((r = read(g_idx.fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + r;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                hash_clear();
+                index_build();
+                return;
+            }
+            int dir = -1;
+            for (int d = 0; d < g_idx.ndirs && dir < 0; d++) {
+                if (g_idx.wd[d] == ev->wd) dir = d;
+            }
+            if (dir < 0) continue;
+
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                /* Gone, and it might come back unwatched. */
+                index_drop_dir(dir);
+                g_idx.wd[dir] = -1;
+                g_idx.complete = 0;
+                hash_clear();
+                continue;
+            }
+            if (!ev->len || (ev->mask & IN_ISDIR) || ev->name[0] == '.') continue;
+            if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) index_remove(ev->name, dir);
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO)) index_insert(ev->name, dir);
+            pathcache_forget(ev->name);
+        }
+    }
+}
+
+static char *index_path(const char *name) {
+    size_t nlen = strlen(name);
+    for (size_t i = index_bound(name, -1); i < g_idx.n && strcmp(g_idx.v[i].name, name) == 0; i++) {
+        const char *dir = g_idx.dirs[g_idx.v[i].dir];
+        size_t dlen = strlen(dir);
+        char *full = (char *)malloc(dlen + nlen + 2);
+        if (!full) return NULL;
+        memcpy(full, dir, dlen);
+        full[dlen] = '/';
+        memcpy(full + dlen + 1, name, nlen + 1);
+
+        struct stat st;
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) return full;
+        free(full);
+    }
+    return NULL;
+}
+
+size_t pathcache_complete(const char *prefix, void (*fn)(const char *name, void *ctx), void *ctx) {
+    check_path_env();
+    index_refresh();
+
+    size_t n = strlen(prefix);
+    size_t count = 0;
+    const char *last = NULL;
+    for (size_t i = index_bound(prefix, -1); i < g_idx.n && strncmp(g_idx.v[i].name, prefix, n) == 0; i++) {
+        if (last && strcmp(last, g_idx.v[i].name) == 0) continue;
+        last = g_idx.v[i].name;
+        fn(last, ctx);
+        count++;
+    }
+    return count;
+}
+
+const char *pathcache_lookup(const char *name) {
+    if (!name || !name[0]) return NULL;
+    if (strchr(name, '/')) return name;
+
+    check_path_env();
+    if (g_idx.built) index_refresh();
+
+    if (g_cap) {
+        PathEntry *e = find_slot(g_table, g_cap, name);
+        if (e->name && g_path_relative) {
+            /* The entry may not hold since the last cd, so search again. */
+            char *path = search_path(name, g_path_env);
+            if (!path) {
+                pathcache_forget(name);
+                return NULL;
+            }
+            if (strcmp(path, e->path) == 0) {
+                free(path);
+            } else {
+                free(e->path);
+                e->path = path;
+            }
+        }
+        if (e->name) {
+            e->hits++;
+            return e->path;
+        }
+    }
+
+    char *path = (g_idx.built && g_idx.complete) ? index_path(name) : search_path(name, g_path_env);
+    if (!path) return NULL;
+
+    if ((g_count + 1) * 2 > g_cap && grow() < 0) {
+        free(path);
+        return NULL;
+    }
+    PathEntry *e = find_slot(g_table, g_cap, name);
+    e->name = xstrdup(name);
+    if (!e->name) {
+        free(path);
+        return NULL;
+    }
+    e->path = path;
+    e->hits = 1;
+    g_count++;
+    return e->path;
+}
+
+/* Looks name up in path, a PATH given for one command, leaving the cache for
+ * the shell's own PATH alone. The result is malloc'd. */
+char *pathcache_search(const char *name, const char *path) {
+    if (!name || !name[0]) return NULL;
+    if (strchr(name, '/')) return xstrdup(name);
+    return search_path(name, path);
+}
+
+void pathcache_forget(const char *name) {
+    if (!g_cap || !name || strchr(name, '/')) return;
+
+    size_t i = hash_name(name) & (g_cap - 1);
+    while (g_table[i].name && strcmp(g_table[i].name, name) != 0) i = (i + 1) & (g_cap - 1);
+    if (!g_table[i].name) return;
+
+    free(g_table[i].name);
+    free(g_table[i].path);
+    g_table[i].name = NULL;
+    g_table[i].path = NULL;
+    g_count--;
+
+    size_t j = (i + 1) & (g_cap - 1);
+    while (g_table[j].name) {
+        PathEntry e = g_table[j];
+        g_table[j].name = NULL;
+        *find_slot(g_table, g_cap, e.name) = e;
+        j = (j + 1) & (g_cap - 1);
+    }
+}
+
+void pathcache_list(void) {
+    if (g_count == 0) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+    printf("hits\tcommand\n");
+    for (size_t i = 0; i < g_cap; i++) {
+        if (g_table[i].name) printf("%4u\t%s\n", g_table[i].hits, g_table[i].path);
+    }
+}
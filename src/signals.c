@@ -2,67 +2,89 @@
 #include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/signalfd.h>
 #include <errno.h>
-#include <fcntl.h>
 #include <string.h>
 
-static int g_sigchld_wfd = -1;
+static volatile sig_atomic_t g_interrupted = 0;
 
-static void sigchld_handler(int signo) {
-    (void)signo;
-    int saved = errno;
+static void on_int(int sig) {
+    (void)sig;
+    g_interrupted = 1;
+}
 
-    Reaped r;
-    pid_t pid;
-    int status;
+int signals_init(void) {
+    signal(SIGINT, SIG_IGN);
 
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        r.pid = pid;
-        r.status = status;
-        if (g_sigchld_wfd >= 0) {
-            ssize_t w = write(g_sigchld_wfd, &r, sizeof(r));
-            (void)w;
-        }
-    }
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &set, NULL) < 0) return -1;
 
-    errno = saved;
+    return signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
 }
 
-static int set_cloexec(int fd) {
-    int flags = fcntl(fd, F_GETFD);
-    if (flags < 0) return -1;
-    return fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
-}
+int signals_job_control(int tty_fd, pid_t *shell_pgid) {
+    pid_t pgid;
+    while (tcgetpgrp(tty_fd) != (pgid = getpgrp())) kill(-pgid, SIGTTIN);
 
-static int set_nonblock(int fd) {
-    int flags = fcntl(fd, F_GETFL);
-    if (flags < 0) return -1;
-    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-}
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
 
-int signals_init(int sigchld_pipe[2]) {
-    if (pipe(sigchld_pipe) < 0) return -1;
-
-    set_cloexec(sigchld_pipe[0]);
-    set_cloexec(sigchld_pipe[1]);
-    set_nonblock(sigchld_pipe[0]);
+    pgid = getpid();
+    if (getpgrp() != pgid && setpgid(0, pgid) < 0) return -1;
+    if (tcsetpgrp(tty_fd, pgid) < 0) return -1;
+    *shell_pgid = pgid;
+    return 0;
+}
 
-    g_sigchld_wfd = sigchld_pipe[1];
+/* SIGINT is ignored at the prompt. While a loop runs it is recorded instead,
+ * so a loop of builtins can still be stopped with Ctrl-C. */
+void signals_catch_int(int on) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on ? on_int : SIG_IGN;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    g_interrupted = 0;
+}
 
-    signal(SIGINT, SIG_IGN);
+static struct sigaction g_int_saved;
 
+/* While the shell itself runs a builtin that can block, Ctrl-C also breaks
+ * off the system call it waits in. Outside a loop the interruption is not
+ * kept afterwards; the builtin's status reports it. */
+void signals_break_int(int on) {
+    if (!on) {
+        sigaction(SIGINT, &g_int_saved, NULL);
+        if (g_int_saved.sa_handler == SIG_IGN) g_interrupted = 0;
+        return;
+    }
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = sigchld_handler;
+    sa.sa_handler = on_int;
     sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
-
-    if (sigaction(SIGCHLD, &sa, NULL) < 0) return -1;
-    return 0;
+    sigaction(SIGINT, &sa, &g_int_saved);
 }
 
-ssize_t signals_read_reaped(int fd, Reaped *buf, size_t max) {
-    if (max == 0) return 0;
-    return read(fd, buf, sizeof(Reaped) * max);
+int signals_interrupted(void) {
+    return g_interrupted;
 }
 
+size_t signals_read_reaped(int fd, Reaped *buf, size_t max) {
+    struct signalfd_siginfo info[16];
+    while (read(fd, info, sizeof(info)) > 0) {
+    }
+
+    size_t n = 0;
+    pid_t pid;
+    while (n < max && (pid = wait4(-1, &buf[n].status, WNOHANG | WUNTRACED | WCONTINUED, &buf[n].ru)) > 0) {
+        buf[n].pid = pid;
+        clock_gettime(CLOCK_MONOTONIC, &buf[n].end);
+        n++;
+    }
+    return n;
+}
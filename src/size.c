@@ -0,0 +1,21 @@
+#include "size.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+
+/* A byte count with an optional K, M or G suffix, or -1 when s is not one
+ * or does not fit. */
+long long size_parse(const char *s) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    if (end == s || v < 0 || errno) return -1;
+    int shift = 0;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (*end || v > (LLONG_MAX >> shift)) return -1;
+    return v << shift;
+}
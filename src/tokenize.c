@@ -0,0 +1,412 @@
+#include "tokenize.h"
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZE_X86 1
+#endif
+
+typedef size_t (*scan_fn)(const char *s, size_t i, size_t n);
+
+/* Newline is a separator token, not space, so multi-line blocks keep their
+ * structure. */
+static int is_space_byte(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r' && c != '\n');
+}
+
+static int is_special_char(char c) {
+    return (c == '<' || c == '>' || c == '|' || c == '&' || c == ';' || c == '\n');
+}
+
+static size_t skip_space_scalar(const char *s, size_t i, size_t n) {
+    while (i < n && is_space_byte((unsigned char)s[i])) i++;
+    return i;
+}
+
+static size_t find_delim_scalar(const char *s, size_t i, size_t n) {
+    while (i < n && !is_space_byte((unsigned char)s[i]) && !is_special_char(s[i])) i++;
+    return i;
+}
+
+#ifdef TOKENIZE_X86
+static unsigned space_mask_sse2(__m128i v) {
+    __m128i r = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(r, _mm_set1_epi8(4)), r);
+    __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    ctl = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), ctl);
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(ctl, sp));
+}
+
+static unsigned delim_mask_sse2(__m128i v) {
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('<')), _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    return (unsigned)_mm_movemask_epi8(m) | space_mask_sse2(v);
+}
+
+static size_t skip_space_sse2(const char *s, size_t i, size_t n) {
+    while (i + 16 <= n) {
+        unsigned m = ~space_mask_sse2(_mm_loadu_si128((const __m128i *)(s + i))) & 0xffffu;
+        if (m) return i + (size_t)__builtin_ctz(m);
+        i += 16;
+    }
+    return skip_space_scalar(s, i, n);
+}
+
+static size_t find_delim_sse2(const char *s, size_t i, size_t n) {
+    while (i + 16 <= n) {
+        unsigned m = delim_mask_sse2(_mm_loadu_si128((const __m128i *)(s + i)));
+        if (m) return i + (size_t)__builtin_ctz(m);
+        i += 16;
+    }
+    return find_delim_scalar(s, i, n);
+}
+
+__attribute__((target("avx2")))
+static unsigned space_mask_avx2(__m256i v) {
+    __m256i r = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(r, _mm256_set1_epi8(4)), r);
+    __m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), ctl);
+    return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(ctl, sp));
+}
+
+__attribute__((target("avx2")))
+static size_t skip_space_avx2(const char *s, size_t i, size_t n) {
+    while (i + 32 <= n) {
+        unsigned m = ~space_mask_avx2(_mm256_loadu_si256((const __m256i *)(s + i)));
+        if (m) return i + (size_t)__builtin_ctz(m);
+        i += 32;
+    }
+    return skip_space_sse2(s, i, n);
+}
+
+__attribute__((target("avx2")))
+static size_t find_delim_avx2(const char *s, size_t i, size_t n) {
+    while (i + 32 <= n) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')),
+                                    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+        unsigned bits = (unsigned)_mm256_movemask_epi8(m) | space_mask_avx2(v);
+        if (bits) return i + (size_t)__builtin_ctz(bits);
+        i += 32;
+    }
+    return find_delim_sse2(s, i, n);
+}
+#endif
+
+typedef struct ScanImpl {
+    const char *name;
+    scan_fn skip_space;
+    scan_fn find_delim;
+} ScanImpl;
+
+static const ScanImpl impls[] = {
+    { "scalar", skip_space_scalar, find_delim_scalar },
+#ifdef TOKENIZE_X86
+    { "sse2", skip_space_sse2, find_delim_sse2 },
+    { "avx2", skip_space_avx2, find_delim_avx2 },
+#endif
+};
+
+static const ScanImpl *g_impl = NULL;
+
+static int impl_supported(const ScanImpl *im) {
+#ifdef TOKENIZE_X86
+    if (strcmp(im->name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+#endif
+    (void)im;
+    return 1;
+}
+
+static const ScanImpl *impl_get(void) {
+    if (!g_impl) {
+        for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+            if (impl_supported(&impls[i])) g_impl = &impls[i];
+        }
+    }
+    return g_impl;
+}
+
+int tokenize_set_impl(const char *name) {
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (strcmp(impls[i].name, name) == 0 && impl_supported(&impls[i])) {
+            g_impl = &impls[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *tokenize_impl_name(void) {
+    return impl_get()->name;
+}
+
+/* A here-document delimiter may be quoted ('EOF' or "EOF") to turn off
+ * expansion in the body; the quotes are not part of the delimiter line. */
+static void heredoc_delim(const char *w, size_t len, const char **d, size_t *dlen) {
+    if (len >= 2 && (w[0] == '\'' || w[0] == '"') && w[len - 1] == w[0]) {
+        w++;
+        len -= 2;
+    }
+    *d = w;
+    *dlen = len;
+}
+
+/* The body starting at s[from] runs up to a line that is exactly the
+ * delimiter. Sets *next past that line, or returns -1 if it has not been
+ * read yet. */
+static int heredoc_body(const char *s, size_t from, size_t n, const char *d, size_t dlen, size_t *body_len, size_t *next) {
+    size_t ls = from;
+    while (ls < n) {
+        const char *nl = (const char *)memchr(s + ls, '\n', n - ls);
+        size_t le = nl ? (size_t)(nl - s) : n;
+        if (le - ls == dlen && memcmp(s + ls, d, dlen) == 0) {
+            *body_len = ls - from;
+            *next = nl ? le + 1 : n;
+            return 0;
+        }
+        ls = le + 1;
+    }
+    return -1;
+}
+
+/* Where the next here-document body starts: after the line holding word w,
+ * or after the previous body on that line. */
+static size_t body_start(const char *s, size_t w_end, size_t n, size_t skip_to) {
+    if (skip_to) return skip_to;
+    const char *nl = (const char *)memchr(s + w_end, '\n', n - w_end);
+    return nl ? (size_t)(nl - s) + 1 : n;
+}
+
+static int push_slice(Arena *a, Token **tokens, int *ntok, int *cap, size_t off, size_t len, int kind) {
+    if (*ntok == *cap) {
+        int newcap = (*cap == 0) ? 16 : (*cap * 2);
+        Token *tmp = (Token *)arena_alloc(a, sizeof(Token) * newcap);
+        if (!tmp) return -1;
+        if (*ntok) memcpy(tmp, *tokens, sizeof(Token) * (size_t)*ntok);
+        *tokens = tmp;
+        *cap = newcap;
+    }
+    Token *t = &(*tokens)[(*ntok)++];
+    t->off = (unsigned int)off;
+    t->len = (unsigned int)len;
+    t->kind = kind;
+    return 0;
+}
+
+int tokenize_slices(Arena *a, const char *s, size_t n, Token **out_tokens, int *out_n) {
+    const ScanImpl *im = impl_get();
+    Token *tokens = NULL;
+    int ntok = 0, cap = 0;
+
+    /* Here-document bodies are emitted right after their delimiter word and
+     * skipped when the scan reaches them: they occupy [skip_at, skip_to). */
+    size_t skip_at = SIZE_MAX, skip_to = 0;
+    int want_delim = 0;
+
+    size_t i = 0;
+    for (;;) {
+        if (i == skip_at) {
+            i = skip_to;
+            skip_at = SIZE_MAX;
+            skip_to = 0;
+        }
+        if (i < n && is_space_byte((unsigned char)s[i])) i = im->skip_space(s, i, n);
+        if (i >= n) break;
+
+        int kind = TOK_WORD;
+        size_t len = 1;
+        switch (s[i]) {
+        case '<':
+            kind = TOK_IN;
+            if (i + 2 < n && s[i + 1] == '<' && s[i + 2] == '<') {
+                kind = TOK_HERESTR;
+                len = 3;
+            } else if (i + 1 < n && (s[i + 1] == '<' || s[i + 1] == '&')) {
+                kind = s[i + 1] == '<' ? TOK_HEREDOC : TOK_DUP_IN;
+                len = 2;
+            }
+            break;
+        case '>':
+            kind = TOK_OUT;
+            if (i + 1 < n && (s[i + 1] == '>' || s[i + 1] == '&')) {
+                kind = s[i + 1] == '>' ? TOK_APPEND : TOK_DUP_OUT;
+                len = 2;
+            }
+            break;
+        case '|':
+            kind = TOK_PIPE;
+            if (i + 1 < n && s[i + 1] == '|') {
+                kind = TOK_OR;
+                len = 2;
+            }
+            break;
+        case '&':
+            kind = TOK_AMP;
+            if (i + 1 < n && s[i + 1] == '&') {
+                kind = TOK_AND;
+                len = 2;
+            }
+            break;
+        case ';': kind = TOK_SEMI; break;
+        case '\n': kind = TOK_NL; break;
+        default:
+            len = im->find_delim(s, i + 1, n) - i;
+            break;
+        }
+
+        if (push_slice(a, &tokens, &ntok, &cap, i, len, kind) < 0) return -1;
+        i += len;
+
+        if (kind == TOK_WORD && want_delim) {
+            const char *d;
+            size_t dlen, body_len, next;
+            heredoc_delim(s + i - len, len, &d, &dlen);
+            size_t from = body_start(s, i, n, skip_to);
+            if (heredoc_body(s, from, n, d, dlen, &body_len, &next) < 0) {
+                body_len = 0;
+                next = n;
+            } else if (push_slice(a, &tokens, &ntok, &cap, from, body_len, TOK_BODY) < 0) {
+                return -1;
+            }
+            if (skip_at == SIZE_MAX) skip_at = from;
+            skip_to = next;
+        }
+        want_delim = kind == TOK_HEREDOC;
+    }
+
+    *out_tokens = tokens;
+    *out_n = ntok;
+    return 0;
+}
+
+/* Kind of an operator the reference scan cut, judged from its text alone so
+ * it does not share the fast scanner's switch. */
+static int ref_kind(const char *p, size_t len) {
+    static const struct {
+        const char *op;
+        int kind;
+    } ops[] = {
+        { "<<<", TOK_HERESTR }, { "<<", TOK_HEREDOC }, { "<&", TOK_DUP_IN }, { ">>", TOK_APPEND },
+        { ">&", TOK_DUP_OUT }, { "||", TOK_OR }, { "&&", TOK_AND }, { "<", TOK_IN },
+        { ">", TOK_OUT }, { "|", TOK_PIPE }, { "&", TOK_AMP }, { ";", TOK_SEMI }, { "\n", TOK_NL },
+    };
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strlen(ops[i].op) == len && memcmp(ops[i].op, p, len) == 0) return ops[i].kind;
+    }
+    return TOK_WORD;
+}
+
+/* The reference scan keeps its own token storage and here-document code, so
+ * tokdiff checks those parts of the fast scanner too. */
+static void ref_put(Token *tokens, int *ntok, size_t off, size_t len, int kind) {
+    tokens[*ntok].off = (unsigned int)off;
+    tokens[*ntok].len = (unsigned int)len;
+    tokens[*ntok].kind = kind;
+    (*ntok)++;
+}
+
+/* Finds the first line at or after q that reads exactly d, returning its
+ * start with *end set past it, or NULL when there is none. */
+static const char *ref_delim_line(const char *q, const char *d, size_t dlen, const char **end) {
+    while (*q) {
+        const char *e = q;
+        while (*e && *e != '\n') e++;
+        if ((size_t)(e - q) == dlen && strncmp(q, d, dlen) == 0) {
+            *end = *e ? e + 1 : e;
+            return q;
+        }
+        q = *e ? e + 1 : e;
+    }
+    return NULL;
+}
+
+int tokenize_ref(Arena *a, const char *s, Token **out_tokens, int *out_n) {
+    size_t n = strlen(s);
+
+    /* Each token but a body covers at least one byte and a body follows a
+     * word, so 2n + 1 slots always do. */
+    Token *tokens = (Token *)arena_alloc(a, sizeof(Token) * (2 * n + 1));
+    if (!tokens) return -1;
+    int ntok = 0;
+
+    /* Bodies of the current line's here-documents fill [body_at, body_to). */
+    const char *body_at = NULL, *body_to = NULL;
+    int want_delim = 0;
+
+    const char *p = s;
+    while (*p) {
+        if (p == body_at) {
+            p = body_to;
+            body_at = body_to = NULL;
+        }
+        while (*p && *p != '\n' && isspace((unsigned char)*p)) p++;
+        if (!*p) break;
+        int delim = want_delim;
+        want_delim = 0;
+
+        if (*p == '<' && p[1] == '<' && p[2] == '<') {
+            ref_put(tokens, &ntok, (size_t)(p - s), 3, ref_kind(p, 3));
+            p += 3;
+            continue;
+        }
+        if ((*p == '<' || *p == '>') && (p[1] == *p || p[1] == '&')) {
+            ref_put(tokens, &ntok, (size_t)(p - s), 2, ref_kind(p, 2));
+            want_delim = *p == '<' && p[1] == '<';
+            p += 2;
+            continue;
+        }
+
+        if (*p == '>' || *p == '&' || *p == '|') {
+            size_t len = p[1] == *p ? 2 : 1;
+            ref_put(tokens, &ntok, (size_t)(p - s), len, ref_kind(p, len));
+            p += len;
+            continue;
+        }
+
+        if (strchr("<;\n", *p)) {
+            ref_put(tokens, &ntok, (size_t)(p - s), 1, ref_kind(p, 1));
+            p += 1;
+            continue;
+        }
+
+        const char *start = p;
+        while (*p && !(isspace((unsigned char)*p) && *p != '\n') && !strchr("<>|&;\n", *p)) p++;
+        ref_put(tokens, &ntok, (size_t)(start - s), (size_t)(p - start), TOK_WORD);
+        if (!delim) continue;
+
+        /* A word right after << is a delimiter, quoted or not. Its body
+         * starts on the next line, or after the line's previous body. */
+        const char *d = start;
+        size_t dlen = (size_t)(p - start);
+        if (dlen >= 2 && (d[0] == '\'' || d[0] == '"') && d[dlen - 1] == d[0]) {
+            d++;
+            dlen -= 2;
+        }
+        const char *from = body_to;
+        if (!from) {
+            from = p;
+            while (*from && *from != '\n') from++;
+            if (*from) from++;
+        }
+        const char *end;
+        const char *line = ref_delim_line(from, d, dlen, &end);
+        if (line) ref_put(tokens, &ntok, (size_t)(from - s), (size_t)(line - from), TOK_BODY);
+        else end = s + n;
+        if (!body_at) body_at = from;
+        body_to = end;
+    }
+
+    *out_tokens = tokens;
+    *out_n = ntok;
+    return 0;
+}
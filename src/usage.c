@@ -0,0 +1,67 @@
+#include "usage.h"
+#include <string.h>
+
+void usage_begin(Usage *u) {
+    memset(u, 0, sizeof(*u));
+    clock_gettime(CLOCK_MONOTONIC, &u->start);
+    u->end = u->start;
+}
+
+static void tv_add(struct timeval *a, const struct timeval *b) {
+    a->tv_sec += b->tv_sec;
+    a->tv_usec += b->tv_usec;
+    if (a->tv_usec >= 1000000) {
+        a->tv_sec++;
+        a->tv_usec -= 1000000;
+    }
+}
+
+void usage_add(Usage *u, const struct rusage *ru, const struct timespec *end) {
+    tv_add(&u->ru.ru_utime, &ru->ru_utime);
+    tv_add(&u->ru.ru_stime, &ru->ru_stime);
+    if (ru->ru_maxrss > u->ru.ru_maxrss) u->ru.ru_maxrss = ru->ru_maxrss;
+    u->ru.ru_nvcsw += ru->ru_nvcsw;
+    u->ru.ru_nivcsw += ru->ru_nivcsw;
+    u->ru.ru_minflt += ru->ru_minflt;
+    u->ru.ru_majflt += ru->ru_majflt;
+
+    if (end->tv_sec > u->end.tv_sec || (end->tv_sec == u->end.tv_sec && end->tv_nsec > u->end.tv_nsec)) {
+        u->end = *end;
+    }
+}
+
+static void tv_sub(struct timeval *a, const struct timeval *b) {
+    a->tv_sec -= b->tv_sec;
+    a->tv_usec -= b->tv_usec;
+    if (a->tv_usec < 0) {
+        a->tv_sec--;
+        a->tv_usec += 1000000;
+    }
+}
+
+void usage_end_self(Usage *u, const struct rusage *before) {
+    clock_gettime(CLOCK_MONOTONIC, &u->end);
+    getrusage(RUSAGE_SELF, &u->ru);
+    tv_sub(&u->ru.ru_utime, &before->ru_utime);
+    tv_sub(&u->ru.ru_stime, &before->ru_stime);
+    u->ru.ru_nvcsw -= before->ru_nvcsw;
+    u->ru.ru_nivcsw -= before->ru_nivcsw;
+    u->ru.ru_minflt -= before->ru_minflt;
+    u->ru.ru_majflt -= before->ru_majflt;
+}
+
+double usage_wall(const Usage *u) {
+    return (double)(u->end.tv_sec - u->start.tv_sec) + (double)(u->end.tv_nsec - u->start.tv_nsec) / 1e9;
+}
+
+double usage_seconds(const struct timeval *tv) {
+    return (double)tv->tv_sec + (double)tv->tv_usec / 1e6;
+}
+
+void usage_print(FILE *f, const Usage *u) {
+    fprintf(f, "real\t%.3fs\n", usage_wall(u));
+    fprintf(f, "user\t%.3fs\n", usage_seconds(&u->ru.ru_utime));
+    fprintf(f, "sys\t%.3fs\n", usage_seconds(&u->ru.ru_stime));
+    fprintf(f, "maxrss\t%ld KB\n", u->ru.ru_maxrss);
+    fprintf(f, "ctxsw\t%ld voluntary, %ld involuntary\n", u->ru.ru_nvcsw, u->ru.ru_nivcsw);
+}
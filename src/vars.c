@@ -0,0 +1,242 @@
+#include "vars.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Each variable is one "name=value" string, so an exported one goes into
+ * envp as it is. */
+typedef struct Var {
+    char *env;
+    size_t name_len;
+    int exported;
+} Var;
+
+typedef struct Saved {
+    char *name;
+    char *env;
+    int exported;
+} Saved;
+
+static Var *g_vars = NULL;
+static size_t g_cap = 0;
+static size_t g_count = 0;
+
+static char **g_envp = NULL;
+static size_t g_envp_cap = 0;
+static int g_dirty = 1;
+
+static Saved *g_saved = NULL;
+static size_t g_nsaved = 0;
+static size_t g_saved_cap = 0;
+
+static char *xstrdup(const char *s) {
+    size_t n = strlen(s);
+    char *p = (char *)malloc(n + 1);
+    if (!p) return NULL;
+    memcpy(p, s, n + 1);
+    return p;
+}
+
+static size_t hash_name(const char *s, size_t n) {
+    size_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static Var *find_slot(Var *table, size_t cap, const char *name, size_t n) {
+    size_t i = hash_name(name, n) & (cap - 1);
+    while (table[i].env && !(table[i].name_len == n && memcmp(table[i].env, name, n) == 0)) i = (i + 1) & (cap - 1);
+    return &table[i];
+}
+
+static int grow(void) {
+    size_t newcap = g_cap ? g_cap * 2 : 64;
+    Var *t = (Var *)calloc(newcap, sizeof(Var));
+    if (!t) return -1;
+    for (size_t i = 0; i < g_cap; i++) {
+        if (g_vars[i].env) *find_slot(t, newcap, g_vars[i].env, g_vars[i].name_len) = g_vars[i];
+    }
+    free(g_vars);
+    g_vars = t;
+    g_cap = newcap;
+    return 0;
+}
+
+static Var *lookup(const char *name, size_t n) {
+    if (!g_cap) return NULL;
+    Var *v = find_slot(g_vars, g_cap, name, n);
+    return v->env ? v : NULL;
+}
+
+static char *make_env(const char *name, size_t n, const char *value) {
+    size_t vlen = strlen(value);
+    char *env = (char *)malloc(n + vlen + 2);
+    if (!env) return NULL;
+    memcpy(env, name, n);
+    env[n] = '=';
+    memcpy(env + n + 1, value, vlen + 1);
+    return env;
+}
+
+/* Takes ownership of env. */
+static int put(const char *name, size_t n, char *env, int exported) {
+    if (!env) return -1;
+    if ((g_count + 1) * 2 > g_cap && grow() < 0) {
+        free(env);
+        return -1;
+    }
+    Var *v = find_slot(g_vars, g_cap, name, n);
+    if (v->env) {
+        free(v->env);
+    } else {
+        v->name_len = n;
+        v->exported = 0;
+        g_count++;
+    }
+    v->env = env;
+    if (exported != VARS_KEEP) {
+        if (v->exported != exported) g_dirty = 1;
+        v->exported = exported;
+    }
+    if (v->exported) g_dirty = 1;
+    return 0;
+}
+
+int vars_valid_name(const char *s, size_t len) {
+    if (len == 0 || (s[0] >= '0' && s[0] <= '9')) return 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))) return 0;
+    }
+    return 1;
+}
+
+int vars_init(char **env) {
+    for (; env && *env; env++) {
+        const char *eq = strchr(*env, '=');
+        if (!eq || !vars_valid_name(*env, (size_t)(eq - *env))) continue;
+        if (put(*env, (size_t)(eq - *env), xstrdup(*env), 1) < 0) return -1;
+    }
+    return 0;
+}
+
+const char *vars_get_n(const char *name, size_t len) {
+    Var *v = lookup(name, len);
+    return v ? v->env + v->name_len + 1 : NULL;
+}
+
+const char *vars_get(const char *name) {
+    return vars_get_n(name, strlen(name));
+}
+
+int vars_set(const char *name, const char *value, int exported) {
+    size_t n = strlen(name);
+    return put(name, n, make_env(name, n, value), exported);
+}
+
+/* word is NAME=value. */
+int vars_assign(const char *word, int exported) {
+    const char *eq = strchr(word, '=');
+    if (!eq) return -1;
+    return put(word, (size_t)(eq - word), xstrdup(word), exported);
+}
+
+int vars_unset(const char *name) {
+    size_t n = strlen(name);
+    Var *v = lookup(name, n);
+    if (!v) return 0;
+
+    if (v->exported) g_dirty = 1;
+    free(v->env);
+    v->env = NULL;
+    g_count--;
+
+    size_t j = ((size_t)(v - g_vars) + 1) & (g_cap - 1);
+    while (g_vars[j].env) {
+        Var e = g_vars[j];
+        g_vars[j].env = NULL;
+        *find_slot(g_vars, g_cap, e.env, e.name_len) = e;
+        j = (j + 1) & (g_cap - 1);
+    }
+    return 0;
+}
+
+/* Rebuilt only after an exported variable changed. */
+char **vars_envp(void) {
+    if (!g_dirty && g_envp) return g_envp;
+
+    size_t n = 0;
+    for (size_t i = 0; i < g_cap; i++) {
+        if (g_vars[i].env && g_vars[i].exported) n++;
+    }
+    if (n + 1 > g_envp_cap) {
+        char **envp = (char **)realloc(g_envp, sizeof(char *) * (n + 1));
+        if (!envp) return g_envp;
+        g_envp = envp;
+        g_envp_cap = n + 1;
+    }
+    n = 0;
+    for (size_t i = 0; i < g_cap; i++) {
+        if (g_vars[i].env && g_vars[i].exported) g_envp[n++] = g_vars[i].env;
+    }
+    g_envp[n] = NULL;
+    g_dirty = 0;
+    return g_envp;
+}
+
+static int cmp_env(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+void vars_list(FILE *out, int exported_only) {
+    char **list = (char **)malloc(sizeof(char *) * (g_count ? g_count : 1));
+    if (!list) return;
+    size_t n = 0;
+    for (size_t i = 0; i < g_cap; i++) {
+        if (g_vars[i].env && (g_vars[i].exported || !exported_only)) list[n++] = g_vars[i].env;
+    }
+    qsort(list, n, sizeof(char *), cmp_env);
+    for (size_t i = 0; i < n; i++) fprintf(out, exported_only ? "export %s\n" : "%s\n", list[i]);
+    free(list);
+}
+
+/* NAME=value words in front of a command are exported for that command only;
+ * vars_pop puts the previous values back. */
+size_t vars_push(char **words, int n) {
+    size_t mark = g_nsaved;
+    for (int i = 0; i < n; i++) {
+        if (g_nsaved == g_saved_cap) {
+            size_t cap = g_saved_cap ? g_saved_cap * 2 : 8;
+            Saved *s = (Saved *)realloc(g_saved, sizeof(Saved) * cap);
+            if (!s) break;
+            g_saved = s;
+            g_saved_cap = cap;
+        }
+        const char *eq = strchr(words[i], '=');
+        size_t len = (size_t)(eq - words[i]);
+        Var *v = lookup(words[i], len);
+
+        Saved *s = &g_saved[g_nsaved];
+        s->name = (char *)malloc(len + 1);
+        if (!s->name) break;
+        memcpy(s->name, words[i], len);
+        s->name[len] = '\0';
+        s->env = v ? xstrdup(v->env) : NULL;
+        s->exported = v ? v->exported : 0;
+        g_nsaved++;
+
+        vars_assign(words[i], 1);
+    }
+    return mark;
+}
+
+void vars_pop(size_t mark) {
+    while (g_nsaved > mark) {
+        Saved *s = &g_saved[--g_nsaved];
+        if (s->env) put(s->name, strlen(s->name), s->env, s->exported);
+        else vars_unset(s->name);
+        free(s->name);
+    }
+}
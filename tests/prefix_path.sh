@@ -0,0 +1,31 @@
+#!/bin/sh
+# A PATH= prefix must apply to finding the command, not only to its
+# environment, with either launch backend, alone or in a pipeline.
+# usage: tests/prefix_path.sh
+
+SHELL_BIN=${SHELL_BIN:-./myshell}
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+printf '#!/bin/sh\necho probe-found\n' > "$DIR/myshell-probe"
+chmod +x "$DIR/myshell-probe"
+
+fail=0
+check() {
+    got=$(MYSHELL_LAUNCH=$1 "$SHELL_BIN" -c "$2" 2>&1)
+    if [ "$got" != "$3" ]; then
+        echo "prefix_path: $1: '$2' gave '$got', want '$3'" >&2
+        fail=1
+    fi
+}
+
+for launch in spawn fork; do
+    check $launch "PATH=$DIR myshell-probe" "probe-found"
+    check $launch "PATH=$DIR myshell-probe | cat" "probe-found"
+    check $launch "PATH=$DIR myshell-probe; myshell-probe" "probe-found
+myshell: myshell-probe: command not found"
+    check $launch "PATH=/nonexistent true; /bin/echo ok" "ok"
+done
+
+[ $fail -eq 0 ] && echo "prefix_path: ok"
+exit $fail
@@ -0,0 +1,90 @@
+#include "tokenize.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char alphabet[] = "ab/._-01 \t\v\f\r\n<>|&>>;&&||\n  x<<<a\nab\n'a'";
+
+/* Lines built from these pieces hold here-documents whose delimiter line
+ * does turn up, which random bytes almost never give. */
+static const char *pieces[] = { "<<", "<<<", " ", "\n", "a", "ab", "'a'", "\"ab\"", "''", "\n\n", "a\n", "|", ";", ">&", "\t" };
+
+static size_t heredoc_line(char *line, size_t cap) {
+    size_t n = 0;
+    int count = 1 + rand() % 24;
+    for (int i = 0; i < count; i++) {
+        const char *p = pieces[rand() % (int)(sizeof(pieces) / sizeof(pieces[0]))];
+        size_t len = strlen(p);
+        if (n + len > cap) break;
+        memcpy(line + n, p, len);
+        n += len;
+    }
+    line[n] = '\0';
+    return n;
+}
+
+static int compare(Arena *a, const char *line, size_t n) {
+    Token *ref = NULL;
+    int nref = 0;
+    Token *toks = NULL;
+    int ntok = 0;
+
+    if (tokenize_ref(a, line, &ref, &nref) < 0) return -1;
+    if (tokenize_slices(a, line, n, &toks, &ntok) < 0) return -1;
+
+    if (nref != ntok) return 1;
+    for (int i = 0; i < ntok; i++) {
+        if (ref[i].kind != toks[i].kind || ref[i].off != toks[i].off || ref[i].len != toks[i].len) return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    static const char *impls[] = { "scalar", "sse2", "avx2" };
+    Arena a;
+    arena_init(&a);
+
+    char *line = (char *)malloc(8193);
+    if (!line) return 1;
+
+    int failures = 0;
+    for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+        if (tokenize_set_impl(impls[k]) < 0) {
+            printf("tokdiff: %s not supported, skipped\n", impls[k]);
+            continue;
+        }
+
+        srand(12600);
+        long cases = 0;
+        for (int iter = 0; iter < 50000; iter++) {
+            size_t n;
+            if (iter % 2) {
+                n = heredoc_line(line, 8192);
+            } else {
+                n = (iter % 100 == 0) ? (size_t)(rand() % 8192) : (size_t)(rand() % 160);
+                int spread = 1 + rand() % 8;
+                for (size_t i = 0; i < n; i++) {
+                    if (rand() % spread == 0) line[i] = alphabet[rand() % (int)(sizeof(alphabet) - 1)];
+                    else line[i] = (char)('a' + rand() % 26);
+                }
+                line[n] = '\0';
+            }
+
+            int r = compare(&a, line, n);
+            arena_reset(&a);
+            cases++;
+            if (r != 0) {
+                if (failures++ < 5) fprintf(stderr, "tokdiff: %s mismatch on \"%s\"\n", impls[k], line);
+            }
+        }
+        printf("tokdiff: %s %ld cases\n", impls[k], cases);
+    }
+
+    arena_free(&a);
+    free(line);
+    if (failures) {
+        fprintf(stderr, "tokdiff: %d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}